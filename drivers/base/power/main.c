@@ -169,6 +169,8 @@ static ktime_t initcall_debug_start(struct device *dev)
 		pr_info("calling  %s+ @ %i\n",
 				dev_name(dev), task_pid_nr(current));
 		calltime = ktime_get();
+	} else if (suspend_profile_active()) {
+		calltime = ktime_get();
 	}
 
 	return calltime;
@@ -185,6 +187,9 @@ static void initcall_debug_report(struct device *dev, ktime_t calltime,
 		pr_info("call %s+ returned %d after %Ld usecs\n", dev_name(dev),
 			error, (unsigned long long)ktime_to_ns(delta) >> 10);
 	}
+
+	if (suspend_profile_active())
+		suspend_profile_call(dev_name(dev), NULL, calltime);
 }
 
 /**
@@ -300,6 +305,8 @@ static int pm_noirq_op(struct device *dev,
 				dev_name(dev), task_pid_nr(current),
 				dev->parent ? dev_name(dev->parent) : "none");
 		calltime = ktime_get();
+	} else if (suspend_profile_active()) {
+		calltime = ktime_get();
 	}
 
 	switch (state.event) {
@@ -357,6 +364,9 @@ static int pm_noirq_op(struct device *dev,
 			(unsigned long long)ktime_to_ns(delta) >> 10);
 	}
 
+	if (suspend_profile_active())
+		suspend_profile_call(dev_name(dev), NULL, calltime);
+
 	return error;
 }
 
@@ -462,6 +472,8 @@ static int device_resume_noirq(struct device *dev, pm_message_t state)
 void dpm_resume_noirq(pm_message_t state)
 {
 	ktime_t starttime = ktime_get();
+	ktime_t phasetime =
+		suspend_profile_phase_start(SUSPEND_PHASE_RESUME_NOIRQ);
 
 	mutex_lock(&dpm_list_mtx);
 	while (!list_empty(&dpm_noirq_list)) {
@@ -482,6 +494,7 @@ void dpm_resume_noirq(pm_message_t state)
 	mutex_unlock(&dpm_list_mtx);
 	dpm_show_time(starttime, state, "early");
 	resume_device_irqs();
+	suspend_profile_phase_end(SUSPEND_PHASE_RESUME_NOIRQ, phasetime);
 }
 EXPORT_SYMBOL_GPL(dpm_resume_noirq);
 
@@ -732,9 +745,13 @@ static void dpm_complete(pm_message_t state)
  */
 void dpm_resume_end(pm_message_t state)
 {
+	ktime_t phasetime;
+
 	might_sleep();
+	phasetime = suspend_profile_phase_start(SUSPEND_PHASE_RESUME_DEVICES);
 	dpm_resume(state);
 	dpm_complete(state);
+	suspend_profile_phase_end(SUSPEND_PHASE_RESUME_DEVICES, phasetime);
 }
 EXPORT_SYMBOL_GPL(dpm_resume_end);
 
@@ -809,6 +826,8 @@ static int device_suspend_noirq(struct device *dev, pm_message_t state)
 int dpm_suspend_noirq(pm_message_t state)
 {
 	ktime_t starttime = ktime_get();
+	ktime_t phasetime =
+		suspend_profile_phase_start(SUSPEND_PHASE_SUSPEND_NOIRQ);
 	int error = 0;
 
 	suspend_device_irqs();
@@ -832,6 +851,7 @@ int dpm_suspend_noirq(pm_message_t state)
 		put_device(dev);
 	}
 	mutex_unlock(&dpm_list_mtx);
+	suspend_profile_phase_end(SUSPEND_PHASE_SUSPEND_NOIRQ, phasetime);
 	if (error)
 		dpm_resume_noirq(resume_event(state));
 	else
@@ -1115,12 +1135,15 @@ static int dpm_prepare(pm_message_t state)
  */
 int dpm_suspend_start(pm_message_t state)
 {
+	ktime_t phasetime;
 	int error;
 
 	might_sleep();
+	phasetime = suspend_profile_phase_start(SUSPEND_PHASE_SUSPEND_DEVICES);
 	error = dpm_prepare(state);
 	if (!error)
 		error = dpm_suspend(state);
+	suspend_profile_phase_end(SUSPEND_PHASE_SUSPEND_DEVICES, phasetime);
 	return error;
 }
 EXPORT_SYMBOL_GPL(dpm_suspend_start);
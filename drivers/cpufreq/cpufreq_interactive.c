@@ -19,7 +19,10 @@
 #include <linux/cpu.h>
 #include <linux/cpumask.h>
 #include <linux/cpufreq.h>
+#include <linux/hrtimer.h>
+#include <linux/input.h>
 #include <linux/mutex.h>
+#include <linux/slab.h>
 #include <linux/sched.h>
 #include <linux/tick.h>
 #include <linux/timer.h>
@@ -28,9 +31,47 @@
 
 #include <asm/cputime.h>
 
+#define CREATE_TRACE_POINTS
+#include <trace/events/cpufreq_interactive.h>
+
 static void (*pm_idle_old)(void);
 static atomic_t active_count = ATOMIC_INIT(0);
 
+/* Number of short-term load samples used for load prediction */
+#define LOAD_HISTORY 4
+
+/*
+ * Tunables of one policy.  Each policy gets a copy of the global values
+ * when the governor starts on it, and can then be tuned on its own
+ * through cpuN/cpufreq/interactive.
+ */
+struct cpufreq_interactive_tunables {
+	/* Go to max speed when CPU load at or above this value. */
+	unsigned long go_maxspeed_load;
+	/* Base of exponential raise to max speed; if 0 - jump to maximum */
+	unsigned long boost_factor;
+	/*
+	 * Targeted sustainable load relatively to current frequency.
+	 * If 0, target is set realtively to the max speed
+	 */
+	unsigned long sustain_load;
+	/*
+	 * The minimum amount of time to spend at a frequency before we can
+	 * ramp down.
+	 */
+	unsigned long min_sample_time;
+	/*
+	 * Frequency to raise CPUs to while a boost is in effect.  If 0,
+	 * boost to policy->max.
+	 */
+	unsigned long boost_freq;
+	/*
+	 * If non-zero, extrapolate the trend of the last LOAD_HISTORY
+	 * samples and ramp up ahead of a predicted load increase.
+	 */
+	unsigned long load_predict;
+};
+
 struct cpufreq_interactive_cpuinfo {
 	struct timer_list cpu_timer;
 	int timer_idlecancel;
@@ -44,6 +85,15 @@ struct cpufreq_interactive_cpuinfo {
 	struct cpufreq_frequency_table *freq_table;
 	unsigned int target_freq;
 	int governor_enabled;
+	/* Time an up request was queued, 0 once it has been serviced */
+	u64 up_request_time;
+	/* Ring of the most recent short-term load samples */
+	int load_hist[LOAD_HISTORY];
+	unsigned int load_hist_next;
+	unsigned int load_hist_count;
+	/* Valid for policy->cpu only */
+	struct cpufreq_interactive_tunables tunables;
+	struct kobject *tunables_kobj;
 };
 
 static DEFINE_PER_CPU(struct cpufreq_interactive_cpuinfo, cpuinfo);
@@ -57,111 +107,33 @@ static spinlock_t up_cpumask_lock;
 static cpumask_t down_cpumask;
 static spinlock_t down_cpumask_lock;
 
-/* Go to max speed when CPU load at or above this value. */
 #define DEFAULT_GO_MAXSPEED_LOAD 85
-static unsigned long go_maxspeed_load;
+#define DEFAULT_MIN_SAMPLE_TIME 80000
 
-/* Base of exponential raise to max speed; if 0 - jump to maximum */
-static unsigned long boost_factor;
-
-/*
- * Targeted sustainable load relatively to current frequency.
- * If 0, target is set realtively to the max speed
- */
-static unsigned long sustain_load;
-
-/*
- * The minimum amount of time to spend at a frequency before we can ramp down.
- */
-#define DEFAULT_MIN_SAMPLE_TIME 80000;
-static unsigned long min_sample_time;
-
-#define DEBUG 0
-#define BUFSZ 128
-
-#if DEBUG
-#include <linux/proc_fs.h>
-
-struct dbgln {
-	int cpu;
-	unsigned long jiffy;
-	unsigned long run;
-	char buf[BUFSZ];
+/* Copied into each policy when the governor starts on it */
+static struct cpufreq_interactive_tunables global_tunables = {
+	.go_maxspeed_load = DEFAULT_GO_MAXSPEED_LOAD,
+	.min_sample_time = DEFAULT_MIN_SAMPLE_TIME,
 };
 
-#define NDBGLNS 256
-
-static struct dbgln dbgbuf[NDBGLNS];
-static int dbgbufs;
-static int dbgbufe;
-static struct proc_dir_entry	*dbg_proc;
-static spinlock_t dbgpr_lock;
-
-static u64 up_request_time;
-static unsigned int up_max_latency;
-
-static void dbgpr(char *fmt, ...)
-{
-	va_list args;
-	int n;
-	unsigned long flags;
-
-	spin_lock_irqsave(&dbgpr_lock, flags);
-	n = dbgbufe;
-        va_start(args, fmt);
-        vsnprintf(dbgbuf[n].buf, BUFSZ, fmt, args);
-        va_end(args);
-	dbgbuf[n].cpu = smp_processor_id();
-	dbgbuf[n].run = nr_running();
-	dbgbuf[n].jiffy = jiffies;
-
-	if (++dbgbufe >= NDBGLNS)
-		dbgbufe = 0;
-
-	if (dbgbufe == dbgbufs)
-		if (++dbgbufs >= NDBGLNS)
-			dbgbufs = 0;
+/* Duration of a boost written to boostpulse or raised by input, in usecs */
+#define DEFAULT_BOOSTPULSE_DURATION 80000
+static unsigned long boostpulse_duration;
 
-	spin_unlock_irqrestore(&dbgpr_lock, flags);
-}
-
-static void dbgdump(void)
-{
-	int i, j;
-	unsigned long flags;
-	static struct dbgln prbuf[NDBGLNS];
-
-	spin_lock_irqsave(&dbgpr_lock, flags);
-	i = dbgbufs;
-	j = dbgbufe;
-	memcpy(prbuf, dbgbuf, sizeof(dbgbuf));
-	dbgbufs = 0;
-	dbgbufe = 0;
-	spin_unlock_irqrestore(&dbgpr_lock, flags);
-
-	while (i != j)
-	{
-		printk("%lu %d %lu %s",
-		       prbuf[i].jiffy, prbuf[i].cpu, prbuf[i].run,
-		       prbuf[i].buf);
-		if (++i == NDBGLNS)
-			i = 0;
-	}
-}
+/* Boost on touchscreen input if non-zero */
+static unsigned long input_boost;
 
-static int dbg_proc_read(char *buffer, char **start, off_t offset,
-			       int count, int *peof, void *dat)
-{
-	printk("max up_task latency=%uus\n", up_max_latency);
-	dbgdump();
-	*peof = 1;
-	return 0;
-}
+/* Upper bound on a single cpufreq_interactive_boost() request, in usecs */
+#define MAX_BOOST_DURATION 1000000
 
+/* Time the current boost ends, in usecs of ktime; protected by boost_lock */
+static u64 boost_end_time;
+static DEFINE_SPINLOCK(boost_lock);
 
-#else
-#define dbgpr(...) do {} while (0)
-#endif
+/* Time from an up decision to the speed change; protected by up_cpumask_lock */
+static unsigned int up_latency_max;
+static u64 up_latency_total;
+static unsigned long up_latency_count;
 
 static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 		unsigned int event);
@@ -177,7 +149,8 @@ struct cpufreq_governor cpufreq_gov_interactive = {
 };
 
 static unsigned int cpufreq_interactive_get_target(
-	int cpu_load, int load_since_change, struct cpufreq_policy *policy)
+	int cpu_load, int load_since_change, struct cpufreq_policy *policy,
+	struct cpufreq_interactive_tunables *tunables)
 {
 	unsigned int target_freq;
 
@@ -189,23 +162,168 @@ static unsigned int cpufreq_interactive_get_target(
 	if (load_since_change > cpu_load)
 		cpu_load = load_since_change;
 
-	if (cpu_load >= go_maxspeed_load) {
-		if (!boost_factor)
+	if (cpu_load >= tunables->go_maxspeed_load) {
+		if (!tunables->boost_factor)
 			return policy->max;
 
-		target_freq = policy->cur * boost_factor;
+		target_freq = policy->cur * tunables->boost_factor;
 	}
 	else {
-		if (!sustain_load)
+		if (!tunables->sustain_load)
 			return policy->max * cpu_load / 100;
 
-		target_freq = policy->cur * cpu_load / sustain_load;
+		target_freq = policy->cur * cpu_load / tunables->sustain_load;
 	}
 
 	target_freq = min(target_freq, policy->max);
 	return target_freq;
 }
 
+static void cpufreq_interactive_record_load(
+	struct cpufreq_interactive_cpuinfo *pcpu, int cpu_load)
+{
+	pcpu->load_hist[pcpu->load_hist_next] = cpu_load;
+
+	if (++pcpu->load_hist_next == LOAD_HISTORY)
+		pcpu->load_hist_next = 0;
+
+	if (pcpu->load_hist_count < LOAD_HISTORY)
+		pcpu->load_hist_count++;
+}
+
+/*
+ * Fit a line through the load history by least squares and return its
+ * value one sample ahead.  Samples are centred on the middle of the
+ * window, so with d = 2i - (n - 1) the next sample lies at d = n + 1
+ * and the slope per unit of d is sum(d * load) / sum(d * d).  The
+ * prediction is
+ *
+ *	sum / n + sum(d * load) * (n + 1) / sum(d * d)
+ *
+ * evaluated over a common denominator, so that a linear ramp of whole
+ * numbers extrapolates exactly.
+ */
+static int cpufreq_interactive_predict_load(
+	struct cpufreq_interactive_cpuinfo *pcpu)
+{
+	unsigned int n = pcpu->load_hist_count;
+	unsigned int i, idx;
+	int d, sum = 0, sum_dl = 0, sum_dd = 0;
+	int predicted;
+
+	if (n < 2)
+		return 0;
+
+	/* Oldest sample first */
+	idx = (pcpu->load_hist_next + LOAD_HISTORY - n) % LOAD_HISTORY;
+
+	for (i = 0; i < n; i++) {
+		d = 2 * (int) i - ((int) n - 1);
+		sum += pcpu->load_hist[idx];
+		sum_dl += d * pcpu->load_hist[idx];
+		sum_dd += d * d;
+
+		if (++idx == LOAD_HISTORY)
+			idx = 0;
+	}
+
+	predicted = (sum * sum_dd + sum_dl * (int) ((n + 1) * n)) /
+		(sum_dd * (int) n);
+	return clamp(predicted, 0, 100);
+}
+
+static bool cpufreq_interactive_boosted(u64 now)
+{
+	unsigned long flags;
+	bool boosted;
+
+	spin_lock_irqsave(&boost_lock, flags);
+	boosted = now < boost_end_time;
+	spin_unlock_irqrestore(&boost_lock, flags);
+	return boosted;
+}
+
+static struct cpufreq_interactive_tunables *cpufreq_interactive_tunables(
+	struct cpufreq_interactive_cpuinfo *pcpu)
+{
+	return &per_cpu(cpuinfo, pcpu->policy->cpu).tunables;
+}
+
+static unsigned int cpufreq_interactive_boost_target(
+	struct cpufreq_interactive_cpuinfo *pcpu)
+{
+	struct cpufreq_policy *policy = pcpu->policy;
+	unsigned int freq = cpufreq_interactive_tunables(pcpu)->boost_freq;
+	unsigned int index;
+
+	if (!freq)
+		freq = policy->max;
+
+	freq = clamp(freq, policy->min, policy->max);
+
+	if (!cpufreq_frequency_table_target(policy, pcpu->freq_table, freq,
+					    CPUFREQ_RELATION_H, &index))
+		freq = pcpu->freq_table[index].frequency;
+
+	return freq;
+}
+
+/**
+ * cpufreq_interactive_boost - raise CPU speed ahead of expected load
+ * @duration_us: how long to hold the boost, capped at one second
+ *
+ * Immediately raises every CPU managed by the interactive governor to
+ * the boost frequency and keeps the governor from ramping below it
+ * until the boost expires.  Intended for input, binder or display
+ * events that are known to be followed by a burst of work.  Safe to
+ * call from atomic context.
+ */
+void cpufreq_interactive_boost(unsigned int duration_us)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu;
+	unsigned long flags;
+	unsigned int cpu, freq;
+	u64 now, end;
+	int wake = 0;
+
+	if (!atomic_read(&active_count) || !duration_us)
+		return;
+
+	now = ktime_to_us(ktime_get());
+	end = now + min_t(unsigned int, duration_us, MAX_BOOST_DURATION);
+	trace_cpufreq_interactive_boost(duration_us);
+
+	spin_lock_irqsave(&boost_lock, flags);
+	if (end > boost_end_time)
+		boost_end_time = end;
+	spin_unlock_irqrestore(&boost_lock, flags);
+
+	spin_lock_irqsave(&up_cpumask_lock, flags);
+
+	for_each_online_cpu(cpu) {
+		pcpu = &per_cpu(cpuinfo, cpu);
+		smp_rmb();
+
+		if (!pcpu->governor_enabled)
+			continue;
+
+		freq = cpufreq_interactive_boost_target(pcpu);
+		if (pcpu->target_freq >= freq)
+			continue;
+
+		pcpu->target_freq = freq;
+		pcpu->up_request_time = now;
+		cpumask_set_cpu(cpu, &up_cpumask);
+		wake = 1;
+	}
+
+	spin_unlock_irqrestore(&up_cpumask_lock, flags);
+
+	if (wake)
+		wake_up_process(up_task);
+}
+EXPORT_SYMBOL(cpufreq_interactive_boost);
+
 static void cpufreq_interactive_timer(unsigned long data)
 {
 	unsigned int delta_idle;
@@ -216,16 +334,21 @@ static void cpufreq_interactive_timer(unsigned long data)
 	u64 idle_exit_time;
 	struct cpufreq_interactive_cpuinfo *pcpu =
 		&per_cpu(cpuinfo, data);
+	struct cpufreq_interactive_tunables *tunables;
 	u64 now_idle;
 	unsigned int new_freq;
 	unsigned int index;
 	unsigned long flags;
+	int boosted;
+	u64 now;
 
 	smp_rmb();
 
 	if (!pcpu->governor_enabled)
 		goto exit;
 
+	tunables = cpufreq_interactive_tunables(pcpu);
+
 	/*
 	 * Once pcpu->timer_run_time is updated to >= pcpu->idle_exit_time,
 	 * this lets idle exit know the current idle time sample has
@@ -241,16 +364,8 @@ static void cpufreq_interactive_timer(unsigned long data)
 	smp_wmb();
 
 	/* If we raced with cancelling a timer, skip. */
-	if (!idle_exit_time) {
-		dbgpr("timer %d: no valid idle exit sample\n", (int) data);
+	if (!idle_exit_time)
 		goto exit;
-	}
-
-#if DEBUG
-	if ((int) jiffies - (int) pcpu->cpu_timer.expires >= 10)
-		dbgpr("timer %d: late by %d ticks\n",
-		      (int) data, jiffies - pcpu->cpu_timer.expires);
-#endif
 
 	delta_idle = (unsigned int) cputime64_sub(now_idle, time_in_idle);
 	delta_time = (unsigned int) cputime64_sub(pcpu->timer_run_time,
@@ -259,17 +374,24 @@ static void cpufreq_interactive_timer(unsigned long data)
 	/*
 	 * If timer ran less than 1ms after short-term sample started, retry.
 	 */
-	if (delta_time < 1000) {
-		dbgpr("timer %d: time delta %u too short exit=%llu now=%llu\n", (int) data,
-		      delta_time, idle_exit_time, pcpu->timer_run_time);
+	if (delta_time < 1000)
 		goto rearm;
-	}
 
 	if (delta_idle > delta_time)
 		cpu_load = 0;
 	else
 		cpu_load = 100 * (delta_time - delta_idle) / delta_time;
 
+	cpufreq_interactive_record_load(pcpu, cpu_load);
+
+	if (tunables->load_predict) {
+		int predicted = cpufreq_interactive_predict_load(pcpu);
+
+		trace_cpufreq_interactive_predict(data, cpu_load, predicted);
+		if (predicted > cpu_load)
+			cpu_load = predicted;
+	}
+
 	delta_idle = (unsigned int) cputime64_sub(now_idle,
 						 pcpu->freq_change_time_in_idle);
 	delta_time = (unsigned int) cputime64_sub(pcpu->timer_run_time,
@@ -287,49 +409,66 @@ static void cpufreq_interactive_timer(unsigned long data)
 	 * change) to determine new target frequency
 	 */
 	new_freq = cpufreq_interactive_get_target(cpu_load, load_since_change,
-						  pcpu->policy);
+						  pcpu->policy, tunables);
+
+	now = ktime_to_us(ktime_get());
+	boosted = cpufreq_interactive_boosted(now);
+
+	if (boosted)
+		new_freq = max(new_freq,
+			       cpufreq_interactive_boost_target(pcpu));
 
 	if (cpufreq_frequency_table_target(pcpu->policy, pcpu->freq_table,
 					   new_freq, CPUFREQ_RELATION_H,
 					   &index)) {
-		dbgpr("timer %d: cpufreq_frequency_table_target error\n", (int) data);
+		pr_warn_once("cpufreq_interactive: no frequency for %u\n",
+			     new_freq);
 		goto rearm;
 	}
 
 	new_freq = pcpu->freq_table[index].frequency;
 
-	if (pcpu->target_freq == new_freq)
-	{
-		dbgpr("timer %d: load=%d, already at %d\n", (int) data, cpu_load, new_freq);
+	if (pcpu->target_freq == new_freq) {
+		trace_cpufreq_interactive_already(data, cpu_load,
+						  load_since_change,
+						  pcpu->target_freq, new_freq);
 		goto rearm_if_notmax;
 	}
 
 	/*
-	 * Do not scale down unless we have been at this frequency for the
-	 * minimum sample time.
+	 * Do not scale down while boosted, or unless we have been at this
+	 * frequency for the minimum sample time.
 	 */
 	if (new_freq < pcpu->target_freq) {
-		if (cputime64_sub(pcpu->timer_run_time, pcpu->freq_change_time) <
-		    min_sample_time) {
-			dbgpr("timer %d: load=%d cur=%d tgt=%d not yet\n", (int) data, cpu_load, pcpu->target_freq, new_freq);
+		if (boosted ||
+		    cputime64_sub(pcpu->timer_run_time,
+				  pcpu->freq_change_time) <
+		    tunables->min_sample_time) {
+			trace_cpufreq_interactive_notyet(data, cpu_load,
+							 load_since_change,
+							 pcpu->target_freq,
+							 new_freq);
 			goto rearm;
 		}
 	}
 
-	dbgpr("timer %d: load=%d cur=%d tgt=%d queue\n", (int) data, cpu_load, pcpu->target_freq, new_freq);
-
 	if (new_freq < pcpu->target_freq) {
+		trace_cpufreq_interactive_rampdown(data, cpu_load,
+						   load_since_change,
+						   pcpu->target_freq, new_freq);
 		pcpu->target_freq = new_freq;
 		spin_lock_irqsave(&down_cpumask_lock, flags);
 		cpumask_set_cpu(data, &down_cpumask);
 		spin_unlock_irqrestore(&down_cpumask_lock, flags);
 		queue_work(down_wq, &freq_scale_down_work);
 	} else {
-		pcpu->target_freq = new_freq;
-#if DEBUG
-		up_request_time = ktime_to_us(ktime_get());
-#endif
+		trace_cpufreq_interactive_target(data, cpu_load,
+						 load_since_change,
+						 pcpu->target_freq, new_freq);
 		spin_lock_irqsave(&up_cpumask_lock, flags);
+		pcpu->target_freq = new_freq;
+		if (!pcpu->up_request_time)
+			pcpu->up_request_time = now;
 		cpumask_set_cpu(data, &up_cpumask);
 		spin_unlock_irqrestore(&up_cpumask_lock, flags);
 		wake_up_process(up_task);
@@ -353,10 +492,8 @@ rearm:
 		if (pcpu->target_freq == pcpu->policy->min) {
 			smp_rmb();
 
-			if (pcpu->idling) {
-				dbgpr("timer %d: cpu idle, don't re-arm\n", (int) data);
+			if (pcpu->idling)
 				goto exit;
-			}
 
 			pcpu->timer_idlecancel = 1;
 		}
@@ -364,7 +501,6 @@ rearm:
 		pcpu->time_in_idle = get_cpu_idle_time_us(
 			data, &pcpu->idle_exit_time);
 		mod_timer(&pcpu->cpu_timer, jiffies + 2);
-		dbgpr("timer %d: set timer for %lu exit=%llu\n", (int) data, pcpu->cpu_timer.expires, pcpu->idle_exit_time);
 	}
 
 exit:
@@ -401,9 +537,6 @@ static void cpufreq_interactive_idle(void)
 				smp_processor_id(), &pcpu->idle_exit_time);
 			pcpu->timer_idlecancel = 0;
 			mod_timer(&pcpu->cpu_timer, jiffies + 2);
-			dbgpr("idle: enter at %d, set timer for %lu exit=%llu\n",
-			      pcpu->target_freq, pcpu->cpu_timer.expires,
-			      pcpu->idle_exit_time);
 		}
 #endif
 	} else {
@@ -414,7 +547,6 @@ static void cpufreq_interactive_idle(void)
 		 * CPU didn't go busy; we'll recheck things upon idle exit.
 		 */
 		if (pending && pcpu->timer_idlecancel) {
-			dbgpr("idle: cancel timer for %lu\n", pcpu->cpu_timer.expires);
 			del_timer(&pcpu->cpu_timer);
 			/*
 			 * Ensure last timer run time is after current idle
@@ -449,29 +581,29 @@ static void cpufreq_interactive_idle(void)
 					     &pcpu->idle_exit_time);
 		pcpu->timer_idlecancel = 0;
 		mod_timer(&pcpu->cpu_timer, jiffies + 2);
-		dbgpr("idle: exit, set timer for %lu exit=%llu\n", pcpu->cpu_timer.expires, pcpu->idle_exit_time);
-#if DEBUG
-	} else if (timer_pending(&pcpu->cpu_timer) == 0 &&
-		   pcpu->timer_run_time < pcpu->idle_exit_time) {
-		dbgpr("idle: timer not run yet: exit=%llu tmrrun=%llu\n",
-		      pcpu->idle_exit_time, pcpu->timer_run_time);
-#endif
 	}
 
 }
 
+static void cpufreq_interactive_account_latency(u64 lat)
+{
+	if (lat > UINT_MAX)
+		lat = UINT_MAX;
+
+	if (lat > up_latency_max)
+		up_latency_max = lat;
+
+	up_latency_total += lat;
+	up_latency_count++;
+}
+
 static int cpufreq_interactive_up_task(void *data)
 {
 	unsigned int cpu;
 	cpumask_t tmp_mask;
 	unsigned long flags;
 	struct cpufreq_interactive_cpuinfo *pcpu;
-
-#if DEBUG
-	u64 now;
-	u64 then;
-	unsigned int lat;
-#endif
+	u64 now, then;
 
 	while (1) {
 		set_current_state(TASK_INTERRUPTIBLE);
@@ -488,31 +620,12 @@ static int cpufreq_interactive_up_task(void *data)
 		}
 
 		set_current_state(TASK_RUNNING);
-
-#if DEBUG
-		then = up_request_time;
-		now = ktime_to_us(ktime_get());
-
-		if (now > then) {
-			lat = ktime_to_us(ktime_get()) - then;
-
-			if (lat > up_max_latency)
-				up_max_latency = lat;
-		}
-#endif
-
 		tmp_mask = up_cpumask;
 		cpumask_clear(&up_cpumask);
 		spin_unlock_irqrestore(&up_cpumask_lock, flags);
 
 		for_each_cpu(cpu, &tmp_mask) {
 			pcpu = &per_cpu(cpuinfo, cpu);
-
-			if (nr_running() == 1) {
-				dbgpr("up %d: tgt=%d nothing else running\n", cpu,
-				      pcpu->target_freq);
-			}
-
 			smp_rmb();
 
 			if (!pcpu->governor_enabled)
@@ -524,7 +637,17 @@ static int cpufreq_interactive_up_task(void *data)
 			pcpu->freq_change_time_in_idle =
 				get_cpu_idle_time_us(cpu,
 						     &pcpu->freq_change_time);
-			dbgpr("up %d: set tgt=%d (actual=%d)\n", cpu, pcpu->target_freq, pcpu->policy->cur);
+
+			now = ktime_to_us(ktime_get());
+			spin_lock_irqsave(&up_cpumask_lock, flags);
+			then = pcpu->up_request_time;
+			pcpu->up_request_time = 0;
+			if (then && now > then)
+				cpufreq_interactive_account_latency(now - then);
+			spin_unlock_irqrestore(&up_cpumask_lock, flags);
+
+			trace_cpufreq_interactive_up(cpu, pcpu->target_freq,
+						     pcpu->policy->cur);
 		}
 	}
 
@@ -557,75 +680,176 @@ static void cpufreq_interactive_freq_down(struct work_struct *work)
 		pcpu->freq_change_time_in_idle =
 			get_cpu_idle_time_us(cpu,
 					     &pcpu->freq_change_time);
-		dbgpr("down %d: set tgt=%d (actual=%d)\n", cpu, pcpu->target_freq, pcpu->policy->cur);
+		trace_cpufreq_interactive_down(cpu, pcpu->target_freq,
+					       pcpu->policy->cur);
 	}
 }
 
-static ssize_t show_go_maxspeed_load(struct kobject *kobj,
-				     struct attribute *attr, char *buf)
+/*
+ * Tunables exist both in the global interactive directory and in
+ * cpuN/cpufreq/interactive for each policy running the governor.  A
+ * write to the global file sets the default for policies started later
+ * and is applied to every running policy; a write to a policy file
+ * only affects that policy.
+ */
+struct interactive_attr {
+	struct global_attr global;
+	ssize_t (*show)(struct cpufreq_interactive_tunables *tunables,
+			char *buf);
+	ssize_t (*store)(struct cpufreq_interactive_tunables *tunables,
+			 const char *buf, size_t count);
+};
+
+#define to_interactive_attr(a) \
+	container_of(a, struct interactive_attr, global.attr)
+
+static ssize_t interactive_global_show(struct kobject *kobj,
+				       struct attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", go_maxspeed_load);
+	return to_interactive_attr(attr)->show(&global_tunables, buf);
 }
 
-static ssize_t store_go_maxspeed_load(struct kobject *kobj,
+static ssize_t interactive_global_store(struct kobject *kobj,
 			struct attribute *attr, const char *buf, size_t count)
 {
-	return strict_strtoul(buf, 0, &go_maxspeed_load);
-}
+	struct interactive_attr *iattr = to_interactive_attr(attr);
+	struct cpufreq_interactive_cpuinfo *pcpu;
+	unsigned int cpu;
+	ssize_t ret;
 
-static struct global_attr go_maxspeed_load_attr = __ATTR(go_maxspeed_load, 0644,
-		show_go_maxspeed_load, store_go_maxspeed_load);
+	ret = iattr->store(&global_tunables, buf, count);
+	if (ret < 0)
+		return ret;
 
-static ssize_t show_boost_factor(struct kobject *kobj,
-				     struct attribute *attr, char *buf)
-{
-	return sprintf(buf, "%lu\n", boost_factor);
+	for_each_possible_cpu(cpu) {
+		pcpu = &per_cpu(cpuinfo, cpu);
+		smp_rmb();
+
+		if (pcpu->governor_enabled)
+			iattr->store(&pcpu->tunables, buf, count);
+	}
+
+	return ret;
+}
+
+#define interactive_tunable(name)					\
+static ssize_t show_##name(struct cpufreq_interactive_tunables *tunables, \
+			   char *buf)					\
+{									\
+	return sprintf(buf, "%lu\n", tunables->name);			\
+}									\
+									\
+static ssize_t store_##name(struct cpufreq_interactive_tunables *tunables, \
+			    const char *buf, size_t count)		\
+{									\
+	unsigned long val;						\
+	int ret = strict_strtoul(buf, 0, &val);				\
+									\
+	if (ret)							\
+		return ret;						\
+	tunables->name = val;						\
+	return count;							\
+}									\
+									\
+static struct interactive_attr name##_attr = {				\
+	.global = __ATTR(name, 0644, interactive_global_show,		\
+			 interactive_global_store),			\
+	.show = show_##name,						\
+	.store = store_##name,						\
 }
 
-static ssize_t store_boost_factor(struct kobject *kobj,
+interactive_tunable(go_maxspeed_load);
+interactive_tunable(boost_factor);
+interactive_tunable(sustain_load);
+interactive_tunable(min_sample_time);
+interactive_tunable(boost_freq);
+interactive_tunable(load_predict);
+
+static ssize_t store_boostpulse(struct kobject *kobj,
 			struct attribute *attr, const char *buf, size_t count)
 {
-	return strict_strtoul(buf, 0, &boost_factor);
+	cpufreq_interactive_boost(boostpulse_duration);
+	return count;
 }
 
-static struct global_attr boost_factor_attr = __ATTR(boost_factor, 0644,
-		show_boost_factor, store_boost_factor);
+static struct global_attr boostpulse_attr = __ATTR(boostpulse, 0200,
+		NULL, store_boostpulse);
 
-static ssize_t show_sustain_load(struct kobject *kobj,
-				     struct attribute *attr, char *buf)
+static ssize_t show_boostpulse_duration(struct kobject *kobj,
+					struct attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", sustain_load);
+	return sprintf(buf, "%lu\n", boostpulse_duration);
 }
 
-static ssize_t store_sustain_load(struct kobject *kobj,
+static ssize_t store_boostpulse_duration(struct kobject *kobj,
 			struct attribute *attr, const char *buf, size_t count)
 {
-	return strict_strtoul(buf, 0, &sustain_load);
+	int ret = strict_strtoul(buf, 0, &boostpulse_duration);
+
+	return ret ? ret : count;
 }
 
-static struct global_attr sustain_load_attr = __ATTR(sustain_load, 0644,
-		show_sustain_load, store_sustain_load);
+static struct global_attr boostpulse_duration_attr =
+	__ATTR(boostpulse_duration, 0644,
+	       show_boostpulse_duration, store_boostpulse_duration);
 
-static ssize_t show_min_sample_time(struct kobject *kobj,
+static ssize_t show_input_boost(struct kobject *kobj,
 				struct attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", min_sample_time);
+	return sprintf(buf, "%lu\n", input_boost);
 }
 
-static ssize_t store_min_sample_time(struct kobject *kobj,
+static ssize_t store_input_boost(struct kobject *kobj,
 			struct attribute *attr, const char *buf, size_t count)
 {
-	return strict_strtoul(buf, 0, &min_sample_time);
+	int ret = strict_strtoul(buf, 0, &input_boost);
+
+	return ret ? ret : count;
+}
+
+static struct global_attr input_boost_attr = __ATTR(input_boost, 0644,
+		show_input_boost, store_input_boost);
+
+static ssize_t show_up_latency_max_us(struct kobject *kobj,
+				      struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", up_latency_max);
 }
 
-static struct global_attr min_sample_time_attr = __ATTR(min_sample_time, 0644,
-		show_min_sample_time, store_min_sample_time);
+static struct global_attr up_latency_max_us_attr =
+	__ATTR(up_latency_max_us, 0444, show_up_latency_max_us, NULL);
+
+static ssize_t show_up_latency_avg_us(struct kobject *kobj,
+				      struct attribute *attr, char *buf)
+{
+	unsigned long flags;
+	u64 avg = 0;
+
+	spin_lock_irqsave(&up_cpumask_lock, flags);
+	if (up_latency_count) {
+		avg = up_latency_total;
+		do_div(avg, up_latency_count);
+	}
+	spin_unlock_irqrestore(&up_cpumask_lock, flags);
+
+	return sprintf(buf, "%llu\n", avg);
+}
+
+static struct global_attr up_latency_avg_us_attr =
+	__ATTR(up_latency_avg_us, 0444, show_up_latency_avg_us, NULL);
 
 static struct attribute *interactive_attributes[] = {
-	&go_maxspeed_load_attr.attr,
-	&boost_factor_attr.attr,
-	&sustain_load_attr.attr,
-	&min_sample_time_attr.attr,
+	&go_maxspeed_load_attr.global.attr,
+	&boost_factor_attr.global.attr,
+	&sustain_load_attr.global.attr,
+	&min_sample_time_attr.global.attr,
+	&boost_freq_attr.global.attr,
+	&load_predict_attr.global.attr,
+	&boostpulse_attr.attr,
+	&boostpulse_duration_attr.attr,
+	&input_boost_attr.attr,
+	&up_latency_max_us_attr.attr,
+	&up_latency_avg_us_attr.attr,
 	NULL,
 };
 
@@ -634,6 +858,192 @@ static struct attribute_group interactive_attr_group = {
 	.name = "interactive",
 };
 
+/* Per-policy directory; holds the CPU whose tunables it exposes */
+struct interactive_policy_kobj {
+	struct kobject kobj;
+	unsigned int cpu;
+};
+
+#define to_policy_kobj(k) container_of(k, struct interactive_policy_kobj, kobj)
+
+static struct cpufreq_interactive_tunables *policy_kobj_tunables(
+	struct kobject *kobj)
+{
+	return &per_cpu(cpuinfo, to_policy_kobj(kobj)->cpu).tunables;
+}
+
+static ssize_t interactive_policy_show(struct kobject *kobj,
+				       struct attribute *attr, char *buf)
+{
+	return to_interactive_attr(attr)->show(policy_kobj_tunables(kobj),
+					       buf);
+}
+
+static ssize_t interactive_policy_store(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	return to_interactive_attr(attr)->store(policy_kobj_tunables(kobj),
+						buf, count);
+}
+
+static void interactive_policy_release(struct kobject *kobj)
+{
+	kfree(to_policy_kobj(kobj));
+}
+
+static const struct sysfs_ops interactive_policy_sysfs_ops = {
+	.show	= interactive_policy_show,
+	.store	= interactive_policy_store,
+};
+
+static struct attribute *interactive_policy_attributes[] = {
+	&go_maxspeed_load_attr.global.attr,
+	&boost_factor_attr.global.attr,
+	&sustain_load_attr.global.attr,
+	&min_sample_time_attr.global.attr,
+	&boost_freq_attr.global.attr,
+	&load_predict_attr.global.attr,
+	NULL,
+};
+
+/*
+ * The show/store methods do not take the policy rwsem, so removing
+ * the directory from GOV_STOP, which runs with it held, cannot
+ * deadlock against a concurrent access.
+ */
+static struct kobj_type interactive_policy_ktype = {
+	.sysfs_ops	= &interactive_policy_sysfs_ops,
+	.default_attrs	= interactive_policy_attributes,
+	.release	= interactive_policy_release,
+};
+
+static int cpufreq_interactive_add_policy_kobj(
+	struct cpufreq_interactive_cpuinfo *pcpu, struct cpufreq_policy *policy)
+{
+	struct interactive_policy_kobj *ik;
+	int rc;
+
+	ik = kzalloc(sizeof(*ik), GFP_KERNEL);
+	if (!ik)
+		return -ENOMEM;
+
+	ik->cpu = policy->cpu;
+	rc = kobject_init_and_add(&ik->kobj, &interactive_policy_ktype,
+				  &policy->kobj, "interactive");
+	if (rc) {
+		kobject_put(&ik->kobj);
+		return rc;
+	}
+
+	pcpu->tunables_kobj = &ik->kobj;
+	return 0;
+}
+
+static void cpufreq_interactive_del_policy_kobj(
+	struct cpufreq_interactive_cpuinfo *pcpu)
+{
+	if (pcpu->tunables_kobj) {
+		kobject_put(pcpu->tunables_kobj);
+		pcpu->tunables_kobj = NULL;
+	}
+}
+
+#ifdef CONFIG_INPUT
+static void cpufreq_interactive_input_event(struct input_handle *handle,
+					    unsigned int type,
+					    unsigned int code, int value)
+{
+	/* One boost per report rather than per axis update */
+	if (type == EV_SYN && code == SYN_REPORT && input_boost)
+		cpufreq_interactive_boost(boostpulse_duration);
+}
+
+static int cpufreq_interactive_input_connect(struct input_handler *handler,
+					     struct input_dev *dev,
+					     const struct input_device_id *id)
+{
+	struct input_handle *handle;
+	int error;
+
+	handle = kzalloc(sizeof(struct input_handle), GFP_KERNEL);
+	if (!handle)
+		return -ENOMEM;
+
+	handle->dev = dev;
+	handle->handler = handler;
+	handle->name = "cpufreq_interactive";
+
+	error = input_register_handle(handle);
+	if (error)
+		goto err_free;
+
+	error = input_open_device(handle);
+	if (error)
+		goto err_unregister;
+
+	return 0;
+
+err_unregister:
+	input_unregister_handle(handle);
+err_free:
+	kfree(handle);
+	return error;
+}
+
+static void cpufreq_interactive_input_disconnect(struct input_handle *handle)
+{
+	input_close_device(handle);
+	input_unregister_handle(handle);
+	kfree(handle);
+}
+
+static const struct input_device_id cpufreq_interactive_ids[] = {
+	{
+		/* Multi-touch touchscreens */
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT |
+			 INPUT_DEVICE_ID_MATCH_ABSBIT,
+		.evbit = { BIT_MASK(EV_ABS) },
+		.absbit = { [BIT_WORD(ABS_MT_POSITION_X)] =
+			    BIT_MASK(ABS_MT_POSITION_X) |
+			    BIT_MASK(ABS_MT_POSITION_Y) },
+	},
+	{
+		/* Single-touch touchscreens and touchpads */
+		.flags = INPUT_DEVICE_ID_MATCH_KEYBIT |
+			 INPUT_DEVICE_ID_MATCH_ABSBIT,
+		.keybit = { [BIT_WORD(BTN_TOUCH)] = BIT_MASK(BTN_TOUCH) },
+		.absbit = { [BIT_WORD(ABS_X)] =
+			    BIT_MASK(ABS_X) | BIT_MASK(ABS_Y) },
+	},
+	{ },
+};
+
+static struct input_handler cpufreq_interactive_input_handler = {
+	.event		= cpufreq_interactive_input_event,
+	.connect	= cpufreq_interactive_input_connect,
+	.disconnect	= cpufreq_interactive_input_disconnect,
+	.name		= "cpufreq_interactive",
+	.id_table	= cpufreq_interactive_ids,
+};
+
+static void cpufreq_interactive_input_register(void)
+{
+	int rc = input_register_handler(&cpufreq_interactive_input_handler);
+
+	if (rc)
+		pr_warning("cpufreq_interactive: input boost unavailable: %d\n",
+			   rc);
+}
+
+static void cpufreq_interactive_input_unregister(void)
+{
+	input_unregister_handler(&cpufreq_interactive_input_handler);
+}
+#else
+static inline void cpufreq_interactive_input_register(void) {}
+static inline void cpufreq_interactive_input_unregister(void) {}
+#endif
+
 static int cpufreq_governor_interactive(struct cpufreq_policy *new_policy,
 		unsigned int event)
 {
@@ -646,9 +1056,17 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *new_policy,
 		if (!cpu_online(new_policy->cpu))
 			return -EINVAL;
 
+		pcpu->tunables = global_tunables;
+		rc = cpufreq_interactive_add_policy_kobj(pcpu, new_policy);
+		if (rc)
+			return rc;
+
 		pcpu->policy = new_policy;
 		pcpu->freq_table = cpufreq_frequency_get_table(new_policy->cpu);
 		pcpu->target_freq = new_policy->cur;
+		pcpu->up_request_time = 0;
+		pcpu->load_hist_next = 0;
+		pcpu->load_hist_count = 0;
 		pcpu->freq_change_time_in_idle =
 			get_cpu_idle_time_us(new_policy->cpu,
 					     &pcpu->freq_change_time);
@@ -668,6 +1086,7 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *new_policy,
 
 		pm_idle_old = pm_idle;
 		pm_idle = cpufreq_interactive_idle;
+		cpufreq_interactive_input_register();
 		break;
 
 	case CPUFREQ_GOV_STOP:
@@ -682,10 +1101,12 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *new_policy,
 		 * that is trying to run.
 		 */
 		pcpu->idle_exit_time = 0;
+		cpufreq_interactive_del_policy_kobj(pcpu);
 
 		if (atomic_dec_return(&active_count) > 0)
 			return 0;
 
+		cpufreq_interactive_input_unregister();
 		sysfs_remove_group(cpufreq_global_kobject,
 				&interactive_attr_group);
 
@@ -710,8 +1131,7 @@ static int __init cpufreq_interactive_init(void)
 	struct cpufreq_interactive_cpuinfo *pcpu;
 	struct sched_param param = { .sched_priority = MAX_RT_PRIO-1 };
 
-	go_maxspeed_load = DEFAULT_GO_MAXSPEED_LOAD;
-	min_sample_time = DEFAULT_MIN_SAMPLE_TIME;
+	boostpulse_duration = DEFAULT_BOOSTPULSE_DURATION;
 
 	/* Initalize per-cpu timers */
 	for_each_possible_cpu(i) {
@@ -742,12 +1162,6 @@ static int __init cpufreq_interactive_init(void)
 	spin_lock_init(&up_cpumask_lock);
 	spin_lock_init(&down_cpumask_lock);
 
-#if DEBUG
-	spin_lock_init(&dbgpr_lock);
-	dbg_proc = create_proc_entry("igov", S_IWUSR | S_IRUGO, NULL);
-	dbg_proc->read_proc = dbg_proc_read;
-#endif
-
 	return cpufreq_register_governor(&cpufreq_gov_interactive);
 
 err_freeuptask:
@@ -25,19 +25,43 @@
 #include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/time.h>
+#include <linux/percpu.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
 
+/*
+ * struct logger_stage - a CPU's staging buffer for a log
+ *
+ * Writers append whole entries here, each preceded by its sequence number,
+ * without taking log->mutex: they run with preemption disabled and are the
+ * only ones moving 'w_off'. logger_drain() is the only reader and moves
+ * 'r_off' with log->mutex held. Both offsets run freely; stage_offset()
+ * reduces them to an index.
+ */
+struct logger_stage {
+	unsigned char		*buffer;/* LOGGER_STAGE_SIZE bytes */
+	size_t			w_off;	/* end of the last committed entry */
+	size_t			r_off;	/* start of the oldest staged entry */
+};
+
+#define LOGGER_STAGE_SIZE	(8*1024)
+
+#define stage_offset(n)		((n) & (LOGGER_STAGE_SIZE - 1))
+
 /*
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
  * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * mutex 'mutex'. Writers normally go to their CPU's staging buffer instead,
+ * which is merged into the ring buffer whenever someone needs to look at it.
  */
 struct logger_log {
-	unsigned char 		*buffer;/* the ring buffer itself */
+	unsigned char 		*buffer;/* the ring buffer, after a page for
+					 * the mmap header */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
 	struct list_head	readers; /* this log's readers */
@@ -45,6 +69,9 @@ struct logger_log {
 	size_t			w_off;	/* current write head offset */
 	size_t			head;	/* new readers start here */
 	size_t			size;	/* size of the log */
+	struct logger_stage __percpu *stage; /* NULL: always write directly */
+	atomic_t		seq;	/* orders the staged entries */
+	struct logger_mmap_header *mmap_header; /* set up on first mmap */
 };
 
 /*
@@ -57,6 +84,7 @@ struct logger_reader {
 	struct logger_log	*log;	/* associated log */
 	struct list_head	list;	/* entry in logger_log's list */
 	size_t			r_off;	/* current read head offset */
+	int			batch;	/* read() fills the buffer */
 };
 
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
@@ -149,11 +177,14 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
  *
  * 	- O_NONBLOCK works
  * 	- If there are no log entries to read, blocks until log is written to
- * 	- Atomically reads exactly one log entry
+ * 	- Atomically reads exactly one log entry, or in batch mode as many
+ * 	  whole entries as fit
  *
  * Optimal read size is LOGGER_ENTRY_MAX_LEN. Will set errno to EINVAL if read
  * buffer is insufficient to hold next entry.
  */
+static void logger_drain(struct logger_log *log);
+
 static ssize_t logger_read(struct file *file, char __user *buf,
 			   size_t count, loff_t *pos)
 {
@@ -167,6 +198,7 @@ start:
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
 		mutex_lock(&log->mutex);
+		logger_drain(log);
 		ret = (log->w_off == reader->r_off);
 		mutex_unlock(&log->mutex);
 		if (!ret)
@@ -207,6 +239,18 @@ start:
 	/* get exactly one entry from the log */
 	ret = do_read_log_to_user(log, reader, buf, ret);
 
+	/* in batch mode, follow up with every whole entry that still fits */
+	while (reader->batch && ret > 0 && log->w_off != reader->r_off) {
+		ssize_t len = get_entry_len(log, reader->r_off);
+
+		if (count - ret < len)
+			break;
+		len = do_read_log_to_user(log, reader, buf + ret, len);
+		if (len < 0)
+			break;
+		ret += len;
+	}
+
 out:
 	mutex_unlock(&log->mutex);
 
@@ -249,6 +293,31 @@ static inline int clock_interval(size_t a, size_t b, size_t c)
 	return 0;
 }
 
+/*
+ * logger_publish - updates the head and write offset seen by mmap readers
+ *
+ * Must be called after moving the head and before overwriting the entries
+ * it skipped, so that a reader which re-checks the head after copying an
+ * entry out of the mapping knows whether the copy is intact.
+ *
+ * The caller needs to hold log->mutex.
+ */
+static void logger_publish(struct logger_log *log)
+{
+	struct logger_mmap_header *hdr = log->mmap_header;
+
+	if (!hdr)
+		return;
+
+	hdr->seq++;
+	smp_wmb();
+	hdr->head = log->head;
+	hdr->w_off = log->w_off;
+	smp_wmb();
+	hdr->seq++;
+	smp_wmb();
+}
+
 /*
  * fix_up_readers - walk the list of all readers and "fix up" any who were
  * lapped by the writer; also do the same for the default "start head".
@@ -269,6 +338,8 @@ static void fix_up_readers(struct logger_log *log, size_t len)
 	list_for_each_entry(reader, &log->readers, list)
 		if (clock_interval(old, new, reader->r_off))
 			reader->r_off = get_next_entry(log, reader->r_off, len);
+
+	logger_publish(log);
 }
 
 /*
@@ -316,34 +387,242 @@ static ssize_t do_write_log_from_user(struct logger_log *log,
 	return count;
 }
 
+/*
+ * stage_read - copies 'count' bytes at 'off' out of the staging buffer
+ */
+static void stage_read(struct logger_stage *stage, size_t off, void *buf,
+		       size_t count)
+{
+	size_t len;
+
+	off = stage_offset(off);
+	len = min_t(size_t, count, LOGGER_STAGE_SIZE - off);
+	memcpy(buf, stage->buffer + off, len);
+
+	if (count != len)
+		memcpy(buf + len, stage->buffer, count - len);
+}
+
+/*
+ * stage_write - copies 'count' bytes from 'buf' into the staging buffer at
+ * 'off'
+ */
+static void stage_write(struct logger_stage *stage, size_t off,
+			const void *buf, size_t count)
+{
+	size_t len;
+
+	off = stage_offset(off);
+	len = min_t(size_t, count, LOGGER_STAGE_SIZE - off);
+	memcpy(stage->buffer + off, buf, len);
+
+	if (count != len)
+		memcpy(stage->buffer, buf + len, count - len);
+}
+
+/*
+ * stage_write_from_user - like stage_write(), from user-space and without
+ * faulting pages in
+ *
+ * Returns zero on success, -EFAULT if any of 'buf' was not accessible.
+ */
+static int stage_write_from_user(struct logger_stage *stage, size_t off,
+				 const void __user *buf, size_t count)
+{
+	size_t len;
+
+	off = stage_offset(off);
+	len = min_t(size_t, count, LOGGER_STAGE_SIZE - off);
+	if (len && __copy_from_user_inatomic(stage->buffer + off, buf, len))
+		return -EFAULT;
+
+	if (count != len)
+		if (__copy_from_user_inatomic(stage->buffer, buf + len,
+					      count - len))
+			return -EFAULT;
+
+	return 0;
+}
+
+/*
+ * do_write_log_from_stage - writes the 'count' bytes at 'off' in 'stage' to
+ * the log 'log'
+ *
+ * The caller needs to hold log->mutex.
+ */
+static void do_write_log_from_stage(struct logger_log *log,
+				    struct logger_stage *stage,
+				    size_t off, size_t count)
+{
+	size_t len;
+
+	off = stage_offset(off);
+	len = min_t(size_t, count, LOGGER_STAGE_SIZE - off);
+	do_write_log(log, stage->buffer + off, len);
+
+	if (count != len)
+		do_write_log(log, stage->buffer, count - len);
+}
+
+/*
+ * logger_drain - moves every staged entry into the log, oldest first
+ *
+ * Each staging buffer is in order already, so this merges the per-CPU
+ * streams on the sequence numbers, which writers take together with their
+ * timestamps. Readers are fixed up exactly as if the entries had been
+ * written directly.
+ *
+ * The caller needs to hold log->mutex.
+ */
+static void logger_drain(struct logger_log *log)
+{
+	struct logger_stage *stage, *next;
+	struct logger_entry header;
+	__u32 seq, next_seq = 0;
+	size_t len;
+	int cpu;
+
+	if (!log->stage)
+		return;
+
+	while (1) {
+		next = NULL;
+		for_each_possible_cpu(cpu) {
+			stage = per_cpu_ptr(log->stage, cpu);
+			if (ACCESS_ONCE(stage->w_off) == stage->r_off)
+				continue;
+
+			/* pairs with smp_wmb() in logger_stage_entry() */
+			smp_rmb();
+			stage_read(stage, stage->r_off, &seq, sizeof(seq));
+			if (!next || (__s32)(seq - next_seq) < 0) {
+				next = stage;
+				next_seq = seq;
+			}
+		}
+		if (!next)
+			break;
+
+		stage_read(next, next->r_off + sizeof(seq), &header,
+			   sizeof(header));
+		len = sizeof(struct logger_entry) + header.len;
+		fix_up_readers(log, len);
+		do_write_log_from_stage(log, next, next->r_off + sizeof(seq),
+					len);
+		logger_publish(log);
+
+		/* finish copying before the writer may reuse the space */
+		smp_mb();
+		next->r_off += sizeof(seq) + len;
+	}
+}
+
+/*
+ * logger_stage_entry - appends an entry to this CPU's staging buffer
+ *
+ * Called with preemption disabled. If the staging buffer is full or part of
+ * the payload is not resident, nothing is committed and -EAGAIN tells the
+ * caller to write to the log directly instead.
+ *
+ * Returns the number of payload bytes written on success.
+ */
+static ssize_t logger_stage_entry(struct logger_log *log,
+				  struct logger_stage *stage,
+				  struct logger_entry *header,
+				  const struct iovec *iov,
+				  unsigned long nr_segs)
+{
+	size_t off = stage->w_off;
+	struct timespec now;
+	ssize_t ret = 0;
+	__u32 seq;
+
+	if (LOGGER_STAGE_SIZE - (off - ACCESS_ONCE(stage->r_off)) <
+	    sizeof(seq) + sizeof(struct logger_entry) + header->len)
+		return -EAGAIN;
+
+	/* pairs with smp_mb() in logger_drain() */
+	smp_mb();
+
+	seq = atomic_inc_return(&log->seq);
+	now = current_kernel_time();
+	header->sec = now.tv_sec;
+	header->nsec = now.tv_nsec;
+
+	stage_write(stage, off, &seq, sizeof(seq));
+	off += sizeof(seq);
+	stage_write(stage, off, header, sizeof(struct logger_entry));
+	off += sizeof(struct logger_entry);
+
+	pagefault_disable();
+	while (nr_segs-- > 0) {
+		size_t len;
+
+		/* figure out how much of this vector we can keep */
+		len = min_t(size_t, iov->iov_len, header->len - ret);
+
+		if (stage_write_from_user(stage, off, iov->iov_base, len)) {
+			pagefault_enable();
+			return -EAGAIN;
+		}
+
+		iov++;
+		off += len;
+		ret += len;
+	}
+	pagefault_enable();
+
+	/* publish the entry to logger_drain() */
+	smp_wmb();
+	stage->w_off = off;
+
+	return ret;
+}
+
 /*
  * logger_aio_write - our write method, implementing support for write(),
  * writev(), and aio_write(). Writes are our fast path, and we try to optimize
  * them above all else.
+ *
+ * Entries normally go to the writing CPU's staging buffer without taking
+ * log->mutex. Only when that fails do we lock the log, drain the staged
+ * entries so they stay ahead of ours, and write directly.
  */
 ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
 	struct logger_entry header;
 	struct timespec now;
+	size_t orig;
 	ssize_t ret = 0;
 
-	now = current_kernel_time();
-
 	header.pid = current->tgid;
 	header.tid = current->pid;
-	header.sec = now.tv_sec;
-	header.nsec = now.tv_nsec;
 	header.len = min_t(size_t, iocb->ki_left, LOGGER_ENTRY_MAX_PAYLOAD);
 
 	/* null writes succeed, return zero */
 	if (unlikely(!header.len))
 		return 0;
 
+	if (log->stage) {
+		ret = logger_stage_entry(log, get_cpu_ptr(log->stage),
+					 &header, iov, nr_segs);
+		put_cpu_ptr(log->stage);
+		if (ret != -EAGAIN)
+			goto out;
+		ret = 0;
+	}
+
 	mutex_lock(&log->mutex);
 
+	logger_drain(log);
+
+	now = current_kernel_time();
+	header.sec = now.tv_sec;
+	header.nsec = now.tv_nsec;
+	orig = log->w_off;
+
 	/*
 	 * Fix up any readers, pulling them forward to the first readable
 	 * entry after (what will be) the new write offset. We do this now
@@ -365,6 +644,7 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 		nr = do_write_log_from_user(log, iov->iov_base, len);
 		if (unlikely(nr < 0)) {
 			log->w_off = orig;
+			logger_publish(log);
 			mutex_unlock(&log->mutex);
 			return nr;
 		}
@@ -373,10 +653,14 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 		ret += nr;
 	}
 
+	logger_publish(log);
 	mutex_unlock(&log->mutex);
 
-	/* wake up any blocked readers */
-	wake_up_interruptible(&log->wq);
+out:
+	/* wake up any blocked readers; pairs with prepare_to_wait() */
+	smp_mb();
+	if (waitqueue_active(&log->wq))
+		wake_up_interruptible(&log->wq);
 
 	return ret;
 }
@@ -462,7 +746,11 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
+	/* pairs with the barrier in logger_aio_write() */
+	smp_mb();
+
 	mutex_lock(&log->mutex);
+	logger_drain(log);
 	if (log->w_off != reader->r_off)
 		ret |= POLLIN | POLLRDNORM;
 	mutex_unlock(&log->mutex);
@@ -478,6 +766,8 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 
 	mutex_lock(&log->mutex);
 
+	logger_drain(log);
+
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
 		ret = log->size;
@@ -512,6 +802,16 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		list_for_each_entry(reader, &log->readers, list)
 			reader->r_off = log->w_off;
 		log->head = log->w_off;
+		logger_publish(log);
+		ret = 0;
+		break;
+	case LOGGER_SET_READ_BATCH:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		reader = file->private_data;
+		reader->batch = !!arg;
 		ret = 0;
 		break;
 	}
@@ -521,6 +821,40 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	return ret;
 }
 
+/*
+ * logger_mmap - the log's mmap file operation
+ *
+ * Maps a page holding a struct logger_mmap_header, followed by the ring
+ * buffer itself, read-only. Staged entries reach the ring buffer when a
+ * reader drains them, so mmap readers should poll() for new entries.
+ */
+static int logger_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct logger_log *log = file_get_log(file);
+	unsigned long size = vma->vm_end - vma->vm_start;
+	struct logger_mmap_header *hdr;
+
+	if (!(file->f_mode & FMODE_READ))
+		return -EACCES;
+	if (vma->vm_pgoff || size != PAGE_SIZE + log->size)
+		return -EINVAL;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	hdr = (struct logger_mmap_header *)(log->buffer - PAGE_SIZE);
+
+	mutex_lock(&log->mutex);
+	if (!log->mmap_header) {
+		hdr->size = log->size;
+		log->mmap_header = hdr;
+		logger_publish(log);
+	}
+	mutex_unlock(&log->mutex);
+
+	return remap_vmalloc_range(vma, hdr, 0);
+}
+
 static const struct file_operations logger_fops = {
 	.owner = THIS_MODULE,
 	.read = logger_read,
@@ -528,19 +862,18 @@ static const struct file_operations logger_fops = {
 	.poll = logger_poll,
 	.unlocked_ioctl = logger_ioctl,
 	.compat_ioctl = logger_ioctl,
+	.mmap = logger_mmap,
 	.open = logger_open,
 	.release = logger_release,
 };
 
 /*
  * Defines a log structure with name 'NAME' and a size of 'SIZE' bytes, which
- * must be a power of two, greater than LOGGER_ENTRY_MAX_LEN, and less than
- * LONG_MAX minus LOGGER_ENTRY_MAX_LEN.
+ * must be a power of two, greater than LOGGER_ENTRY_MAX_LEN and PAGE_SIZE,
+ * and less than LONG_MAX minus LOGGER_ENTRY_MAX_LEN.
  */
 #define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
-static unsigned char _buf_ ## VAR[SIZE]; \
 static struct logger_log VAR = { \
-	.buffer = _buf_ ## VAR, \
 	.misc = { \
 		.minor = MISC_DYNAMIC_MINOR, \
 		.name = NAME, \
@@ -553,6 +886,7 @@ static struct logger_log VAR = { \
 	.w_off = 0, \
 	.head = 0, \
 	.size = SIZE, \
+	.seq = ATOMIC_INIT(0), \
 };
 
 DEFINE_LOGGER_DEVICE(log_main, LOGGER_LOG_MAIN, 256*1024)
@@ -573,14 +907,67 @@ static struct logger_log *get_log_from_minor(int minor)
 	return NULL;
 }
 
+static void __init free_log_stage(struct logger_log *log)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		kfree(per_cpu_ptr(log->stage, cpu)->buffer);
+	free_percpu(log->stage);
+	log->stage = NULL;
+}
+
+static int __init init_log_stage(struct logger_log *log)
+{
+	struct logger_stage *stage;
+	int cpu;
+
+	log->stage = alloc_percpu(struct logger_stage);
+	if (!log->stage)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		stage = per_cpu_ptr(log->stage, cpu);
+		stage->buffer = kmalloc_node(LOGGER_STAGE_SIZE, GFP_KERNEL,
+					     cpu_to_node(cpu));
+		if (!stage->buffer)
+			goto err;
+	}
+
+	return 0;
+
+err:
+	free_log_stage(log);
+	return -ENOMEM;
+}
+
 static int __init init_log(struct logger_log *log)
 {
+	unsigned char *area;
 	int ret;
 
+	/* one page for the mmap header, then the ring; both can be mapped */
+	area = vmalloc_user(PAGE_SIZE + log->size);
+	if (!area) {
+		printk(KERN_ERR "logger: failed to allocate log '%s'\n",
+		       log->misc.name);
+		return -ENOMEM;
+	}
+	log->buffer = area + PAGE_SIZE;
+
+	/* without staging buffers every write takes log->mutex */
+	if (init_log_stage(log))
+		printk(KERN_WARNING "logger: no staging buffers for "
+		       "log '%s'\n", log->misc.name);
+
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
 		       "device for log '%s'!\n", log->misc.name);
+		if (log->stage)
+			free_log_stage(log);
+		vfree(area);
+		log->buffer = NULL;
 		return ret;
 	}
 
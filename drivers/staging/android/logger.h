@@ -30,6 +30,19 @@ struct logger_entry {
 	char		msg[0];	/* the entry's payload */
 };
 
+/*
+ * The first page of a log mapped with mmap(); the ring buffer follows at
+ * the next page. 'head' and 'w_off' are only valid while 'seq' is even and
+ * unchanged across reading them. An entry copied out of the ring is intact
+ * if, re-checked afterwards, it still lies between 'head' and 'w_off'.
+ */
+struct logger_mmap_header {
+	__u32		seq;	/* odd while head and w_off are updated */
+	__u32		size;	/* size of the ring buffer */
+	__u32		head;	/* offset of the oldest entry */
+	__u32		w_off;	/* offset the next entry goes to */
+};
+
 #define LOGGER_LOG_RADIO	"log_radio"	/* radio-related messages */
 #define LOGGER_LOG_EVENTS	"log_events"	/* system/hardware events */
 #define LOGGER_LOG_SYSTEM	"log_system"	/* system/framework messages */
@@ -45,5 +58,6 @@ struct logger_entry {
 #define LOGGER_GET_LOG_LEN		_IO(__LOGGERIO, 2) /* used log len */
 #define LOGGER_GET_NEXT_ENTRY_LEN	_IO(__LOGGERIO, 3) /* next entry len */
 #define LOGGER_FLUSH_LOG		_IO(__LOGGERIO, 4) /* flush log */
+#define LOGGER_SET_READ_BATCH		_IO(__LOGGERIO, 5) /* batch reads */
 
 #endif /* _LINUX_LOGGER_H */
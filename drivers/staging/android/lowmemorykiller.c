@@ -16,6 +16,20 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * The number of processes killed and the time spent choosing them can be
+ * read from kill_count, select_count, select_time_us and select_time_max_us
+ * in the same directory.
+ *
+ * Before it comes to killing, /dev/lowmem_pressure reports the memory
+ * pressure as "none", "low", "medium" or "critical", one line per read().
+ * A blocking read() or poll() waits for the level to change. The levels
+ * follow the adj and minfree entries from the largest down: low once free
+ * memory is below the largest minfree, where processes with the largest
+ * adj start to be killed, medium below the next entry and critical below
+ * the one after. Background reclaim or a zone below its low watermark
+ * raises the level to at least low and direct reclaim to at least medium,
+ * for a second after it last ran.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -35,6 +49,14 @@
 #include <linux/oom.h>
 #include <linux/sched.h>
 #include <linux/notifier.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <linux/swap.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/poll.h>
+#include <linux/timer.h>
+#include <linux/uaccess.h>
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -55,12 +77,146 @@ static int lowmem_minfree_size = 4;
 static struct task_struct *lowmem_deathpending;
 static unsigned long lowmem_deathpending_timeout;
 
+/*
+ * Every process, by its group leader, on the list for its oom_adj. The
+ * lists follow fork, exec, writes to oom_adj and release_task(), so
+ * lowmem_shrink() only looks at the processes it may kill.
+ *
+ * Changes are made under lowmem_bucket_lock; lowmem_shrink() walks the
+ * lists under RCU. A task is removed from its list in release_task()
+ * before its RCU grace period starts, so a walker never sees it freed.
+ * A task that changes lists under a walker can take the walker along to
+ * its new list, so the walker checks the oom_adj of what it finds.
+ */
+#define LOWMEM_BUCKETS	(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+static struct hlist_head lowmem_buckets[LOWMEM_BUCKETS];
+static DEFINE_SPINLOCK(lowmem_bucket_lock);
+
+static DEFINE_SPINLOCK(lowmem_stats_lock);
+static uint32_t lowmem_kill_count;
+static uint32_t lowmem_select_count;	/* protected by lowmem_stats_lock */
+static unsigned long lowmem_select_time_us;
+static uint32_t lowmem_select_time_max_us;
+
 #define lowmem_print(level, x...)			\
 	do {						\
 		if (lowmem_debug_level >= (level))	\
 			printk(x);			\
 	} while (0)
 
+enum {
+	LOWMEM_PRESSURE_NONE,
+	LOWMEM_PRESSURE_LOW,
+	LOWMEM_PRESSURE_MEDIUM,
+	LOWMEM_PRESSURE_CRITICAL,
+};
+
+static const char * const lowmem_pressure_names[] = {
+	"none",
+	"low",
+	"medium",
+	"critical",
+};
+
+/*
+ * Updated from lowmem_shrink() during reclaim. A level raised by reclaim
+ * is held for LOWMEM_PRESSURE_HOLD after reclaim last reported it, then
+ * falls back to what the page counts say; lowmem_pressure_timer wakes
+ * the readers when it does. Readers never change it; each keeps the
+ * level it last returned itself.
+ */
+#define LOWMEM_PRESSURE_HOLD	HZ
+
+static DEFINE_SPINLOCK(lowmem_pressure_lock);
+static int lowmem_pressure_level;
+static int lowmem_pressure_counted;
+static unsigned long lowmem_pressure_expires;
+static DECLARE_WAIT_QUEUE_HEAD(lowmem_pressure_wait);
+
+static void lowmem_pressure_expire(unsigned long data)
+{
+	wake_up_interruptible(&lowmem_pressure_wait);
+}
+
+static DEFINE_TIMER(lowmem_pressure_timer, lowmem_pressure_expire, 0, 0);
+
+static int lowmem_pressure_for(int other_free, int other_file)
+{
+	int array_size = ARRAY_SIZE(lowmem_adj);
+	int level = LOWMEM_PRESSURE_NONE;
+	struct zone *zone;
+	int i;
+
+	if (lowmem_adj_size < array_size)
+		array_size = lowmem_adj_size;
+	if (lowmem_minfree_size < array_size)
+		array_size = lowmem_minfree_size;
+
+	for (i = array_size - 1; i >= 0; i--) {
+		if (other_free >= lowmem_minfree[i] ||
+		    other_file >= lowmem_minfree[i])
+			break;
+		if (++level == LOWMEM_PRESSURE_CRITICAL)
+			return level;
+	}
+	if (level)
+		return level;
+
+	/* kswapd is or will be busy with this zone */
+	for_each_populated_zone(zone)
+		if (!zone_watermark_ok(zone, 0, low_wmark_pages(zone), 0, 0))
+			return LOWMEM_PRESSURE_LOW;
+
+	return LOWMEM_PRESSURE_NONE;
+}
+
+/* Called with lowmem_pressure_lock held */
+static int lowmem_pressure_raised(void)
+{
+	if (time_after_eq(jiffies, lowmem_pressure_expires))
+		lowmem_pressure_level = LOWMEM_PRESSURE_NONE;
+	return lowmem_pressure_level;
+}
+
+/*
+ * @counted is the level the page counts give now, @reclaim the level the
+ * running reclaim asks for, if any. Readers are woken whenever the level
+ * in effect changes, down as well as up.
+ */
+static void lowmem_pressure_update(int counted, int reclaim)
+{
+	int old, new;
+
+	spin_lock(&lowmem_pressure_lock);
+	old = max(lowmem_pressure_raised(), lowmem_pressure_counted);
+	if (reclaim != LOWMEM_PRESSURE_NONE &&
+	    reclaim >= lowmem_pressure_level) {
+		lowmem_pressure_level = reclaim;
+		lowmem_pressure_expires = jiffies + LOWMEM_PRESSURE_HOLD;
+		mod_timer(&lowmem_pressure_timer, lowmem_pressure_expires);
+	}
+	lowmem_pressure_counted = counted;
+	new = max(lowmem_pressure_level, counted);
+	spin_unlock(&lowmem_pressure_lock);
+
+	if (new != old)
+		wake_up_interruptible(&lowmem_pressure_wait);
+}
+
+static int lowmem_pressure_now(void)
+{
+	int other_free = global_page_state(NR_FREE_PAGES);
+	int other_file = global_page_state(NR_FILE_PAGES) -
+						global_page_state(NR_SHMEM);
+	int level;
+
+	spin_lock(&lowmem_pressure_lock);
+	level = lowmem_pressure_raised();
+	spin_unlock(&lowmem_pressure_lock);
+
+	return max(level, lowmem_pressure_for(other_free, other_file));
+}
+
 static int
 task_notify_func(struct notifier_block *self, unsigned long val, void *data);
 
@@ -79,6 +235,47 @@ task_notify_func(struct notifier_block *self, unsigned long val, void *data)
 	return NOTIFY_OK;
 }
 
+/*
+ * Put the process 'task' belongs to on the list for its current oom_adj,
+ * or take 'task' off its list once release_task() has unhashed it. The
+ * task may be a thread; its group leader is only freed after an RCU grace
+ * period. pid_alive() is checked under lowmem_bucket_lock, so a released
+ * task is never put back on a list.
+ */
+static void lowmem_update_bucket(struct task_struct *task)
+{
+	struct task_struct *leader;
+	int oom_adj;
+
+	if (task->flags & PF_KTHREAD)
+		return;
+
+	rcu_read_lock();
+	spin_lock(&lowmem_bucket_lock);
+	leader = task->group_leader;
+	if (!pid_alive(task)) {
+		hlist_del_init_rcu(&task->oom_adj_node);
+	} else if (pid_alive(leader)) {
+		oom_adj = leader->signal->oom_adj;
+		hlist_del_init_rcu(&leader->oom_adj_node);
+		hlist_add_head_rcu(&leader->oom_adj_node,
+				   &lowmem_buckets[oom_adj - OOM_DISABLE]);
+	}
+	spin_unlock(&lowmem_bucket_lock);
+	rcu_read_unlock();
+}
+
+static int
+oom_adj_notify_func(struct notifier_block *self, unsigned long val, void *data)
+{
+	lowmem_update_bucket(data);
+	return NOTIFY_OK;
+}
+
+static struct notifier_block oom_adj_nb = {
+	.notifier_call	= oom_adj_notify_func,
+};
+
 static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 {
 	struct task_struct *p;
@@ -89,6 +286,10 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 	int min_adj = OOM_ADJUST_MAX + 1;
 	int selected_tasksize = 0;
 	int selected_oom_adj;
+	int oom_adj;
+	struct hlist_node *pos;
+	ktime_t start;
+	uint32_t us;
 	int array_size = ARRAY_SIZE(lowmem_adj);
 	int other_free = global_page_state(NR_FREE_PAGES);
 	int other_file = global_page_state(NR_FILE_PAGES) -
@@ -120,6 +321,10 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 		lowmem_print(3, "lowmem_shrink %d, %x, ofree %d %d, ma %d\n",
 			     nr_to_scan, gfp_mask, other_free, other_file,
 			     min_adj);
+	lowmem_pressure_update(lowmem_pressure_for(other_free, other_file),
+			       nr_to_scan <= 0 ? LOWMEM_PRESSURE_NONE :
+			       current_is_kswapd() ? LOWMEM_PRESSURE_LOW :
+						     LOWMEM_PRESSURE_MEDIUM);
 	rem = global_page_state(NR_ACTIVE_ANON) +
 		global_page_state(NR_ACTIVE_FILE) +
 		global_page_state(NR_INACTIVE_ANON) +
@@ -129,55 +334,66 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 			     nr_to_scan, gfp_mask, rem);
 		return rem;
 	}
+	if (min_adj < OOM_DISABLE)
+		min_adj = OOM_DISABLE;
 	selected_oom_adj = min_adj;
 
-	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
-
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
-			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
+	/* the highest oom_adj with a candidate wins, then the largest rss */
+	start = ktime_get();
+	rcu_read_lock();
+	for (oom_adj = OOM_ADJUST_MAX; oom_adj >= min_adj && !selected;
+	     oom_adj--) {
+		hlist_for_each_entry_rcu(p, pos,
+				&lowmem_buckets[oom_adj - OOM_DISABLE],
+				oom_adj_node) {
+			if (p->signal->oom_adj != oom_adj)
+				continue;
+			task_lock(p);
+			if (!p->mm) {
+				task_unlock(p);
 				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
+			}
+			tasksize = get_mm_rss(p->mm);
+			task_unlock(p);
+			if (tasksize <= selected_tasksize)
 				continue;
+			selected = p;
+			selected_tasksize = tasksize;
+			selected_oom_adj = oom_adj;
 		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
 	}
+	if (selected)
+		get_task_struct(selected);
+	rcu_read_unlock();
+	us = ktime_us_delta(ktime_get(), start);
+	spin_lock(&lowmem_stats_lock);
+	lowmem_select_count++;
+	lowmem_select_time_us += us;
+	if (us > lowmem_select_time_max_us)
+		lowmem_select_time_max_us = us;
+	spin_unlock(&lowmem_stats_lock);
+
 	if (selected) {
+		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
+			     selected->pid, selected->comm, selected_oom_adj,
+			     selected_tasksize);
 		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
 			     selected->pid, selected->comm,
 			     selected_oom_adj, selected_tasksize);
-		lowmem_deathpending = selected;
-		lowmem_deathpending_timeout = jiffies + HZ;
-		force_sig(SIGKILL, selected);
-		rem -= selected_tasksize;
+		/* keeps the task from being released under force_sig() */
+		read_lock(&tasklist_lock);
+		if (pid_alive(selected)) {
+			lowmem_deathpending = selected;
+			lowmem_deathpending_timeout = jiffies + HZ;
+			force_sig(SIGKILL, selected);
+			rem -= selected_tasksize;
+			lowmem_kill_count++;
+		}
+		read_unlock(&tasklist_lock);
+		put_task_struct(selected);
 	}
 	lowmem_print(4, "lowmem_shrink %d, %x, return %d\n",
 		     nr_to_scan, gfp_mask, rem);
-	read_unlock(&tasklist_lock);
 	return rem;
 }
 
@@ -186,17 +402,107 @@ static struct shrinker lowmem_shrinker = {
 	.seeks = DEFAULT_SEEKS * 16
 };
 
+/* file->private_data holds the level last returned to this reader */
+static int lowmem_pressure_open(struct inode *inode, struct file *file)
+{
+	file->private_data = (void *)(long)LOWMEM_PRESSURE_NONE;
+	return nonseekable_open(inode, file);
+}
+
+static ssize_t lowmem_pressure_read(struct file *file, char __user *buf,
+				    size_t count, loff_t *ppos)
+{
+	int last = (long)file->private_data;
+	char tmp[16];
+	int level;
+	int len;
+	int ret;
+
+	if (!(file->f_flags & O_NONBLOCK)) {
+		ret = wait_event_interruptible(lowmem_pressure_wait,
+				(level = lowmem_pressure_now()) != last);
+		if (ret)
+			return ret;
+	} else {
+		level = lowmem_pressure_now();
+	}
+
+	len = snprintf(tmp, sizeof(tmp), "%s\n", lowmem_pressure_names[level]);
+	if (count < len)
+		return -EINVAL;
+	if (copy_to_user(buf, tmp, len))
+		return -EFAULT;
+
+	file->private_data = (void *)(long)level;
+	return len;
+}
+
+static unsigned int lowmem_pressure_poll(struct file *file, poll_table *wait)
+{
+	int last = (long)file->private_data;
+
+	poll_wait(file, &lowmem_pressure_wait, wait);
+
+	if (lowmem_pressure_now() != last)
+		return POLLIN | POLLRDNORM;
+	return 0;
+}
+
+static const struct file_operations lowmem_pressure_fops = {
+	.owner = THIS_MODULE,
+	.open = lowmem_pressure_open,
+	.read = lowmem_pressure_read,
+	.poll = lowmem_pressure_poll,
+};
+
+static struct miscdevice lowmem_pressure_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "lowmem_pressure",
+	.fops = &lowmem_pressure_fops,
+};
+
 static int __init lowmem_init(void)
 {
+	struct task_struct *p;
+	int i;
+
+	for (i = 0; i < LOWMEM_BUCKETS; i++)
+		INIT_HLIST_HEAD(&lowmem_buckets[i]);
+
 	task_free_register(&task_nb);
+	register_oom_adj_notifier(&oom_adj_nb);
+
+	/* pick up the processes forked before the notifier was there */
+	read_lock(&tasklist_lock);
+	for_each_process(p)
+		lowmem_update_bucket(p);
+	read_unlock(&tasklist_lock);
+
 	register_shrinker(&lowmem_shrinker);
+	if (misc_register(&lowmem_pressure_misc))
+		printk(KERN_WARNING "lowmemorykiller: failed to register "
+		       "pressure device\n");
 	return 0;
 }
 
 static void __exit lowmem_exit(void)
 {
+	struct task_struct *p;
+	struct hlist_node *pos, *tmp;
+	int i;
+
+	misc_deregister(&lowmem_pressure_misc);
 	unregister_shrinker(&lowmem_shrinker);
+	del_timer_sync(&lowmem_pressure_timer);
+	unregister_oom_adj_notifier(&oom_adj_nb);
 	task_free_unregister(&task_nb);
+
+	spin_lock(&lowmem_bucket_lock);
+	for (i = 0; i < LOWMEM_BUCKETS; i++)
+		hlist_for_each_entry_safe(p, pos, tmp, &lowmem_buckets[i],
+					  oom_adj_node)
+			hlist_del_init_rcu(&p->oom_adj_node);
+	spin_unlock(&lowmem_bucket_lock);
 }
 
 module_param_named(cost, lowmem_shrinker.seeks, int, S_IRUGO | S_IWUSR);
@@ -205,6 +511,11 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_named(kill_count, lowmem_kill_count, uint, S_IRUGO);
+module_param_named(select_count, lowmem_select_count, uint, S_IRUGO);
+module_param_named(select_time_us, lowmem_select_time_us, ulong, S_IRUGO);
+module_param_named(select_time_max_us, lowmem_select_time_max_us, uint,
+		   S_IRUGO);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
@@ -25,8 +25,10 @@
  */
 
 #include <linux/list.h>
+#include <linux/rcupdate.h>
 #include <linux/spinlock.h>
 #include <linux/atomic.h>
+#include <linux/err.h>
 
 #include "tmem.h"
 
@@ -68,8 +70,11 @@ void tmem_register_pamops(struct tmem_pamops *m)
  * of rb_trees to reduce search, insert, delete, and rebalancing time.
  * Each hashbucket also has a lock to manage concurrent access.
  *
- * The following routines manage tmem_objs.  When any tmem_obj is accessed,
- * the hashbucket lock must be held.
+ * The following routines manage tmem_objs.  When any tmem_obj is changed,
+ * the hashbucket lock must be held and the change must be bracketed by
+ * write_seqcount_begin/end on the hashbucket seq.  tmem_objs and
+ * tmem_objnodes are freed after an rcu grace period, so that
+ * tmem_pampd_absent() can walk them with only rcu_read_lock held.
  */
 
 /* searches for object==oid in pool, returns locked object if found */
@@ -99,9 +104,58 @@ out:
 	return obj;
 }
 
+/*
+ * Lockless version of tmem_obj_find() for tmem_pampd_absent().  The
+ * rbtree rotations are not safe for lockless readers: a walk racing with
+ * one may see a node twice or go round in a loop.  Nodes are only freed
+ * after an rcu grace period, so the walk never touches freed memory, and
+ * it is cut off after TMEM_RB_MAX_DEPTH steps, deeper than any rbtree
+ * that fits in memory can be.  Returns ERR_PTR(-EAGAIN) if cut off; the
+ * caller's seqcount check rejects anything else found during a change.
+ */
+#define TMEM_RB_MAX_DEPTH	(2 * BITS_PER_LONG)
+
+static struct tmem_obj *tmem_obj_find_rcu(struct tmem_hashbucket *hb,
+					struct tmem_oid *oidp)
+{
+	struct rb_node *rbnode;
+	struct tmem_obj *obj;
+	int depth = 0;
+
+	rbnode = ACCESS_ONCE(hb->obj_rb_root.rb_node);
+	while (rbnode) {
+		if (++depth > TMEM_RB_MAX_DEPTH)
+			return ERR_PTR(-EAGAIN);
+		obj = rb_entry(rbnode, struct tmem_obj, rb_tree_node);
+		switch (tmem_oid_compare(oidp, &obj->oid)) {
+		case 0: /* equal */
+			return obj;
+		case -1:
+			rbnode = ACCESS_ONCE(rbnode->rb_left);
+			break;
+		case 1:
+			rbnode = ACCESS_ONCE(rbnode->rb_right);
+			break;
+		}
+	}
+	return NULL;
+}
+
 static void tmem_pampd_destroy_all_in_obj(struct tmem_obj *);
 
-/* free an object that has no more pampds in it */
+static void tmem_obj_free_rcu(struct rcu_head *head)
+{
+	struct tmem_obj *obj = container_of(head, struct tmem_obj, rcu);
+	struct tmem_pool *pool = obj->pool;
+
+	obj->pool = NULL;
+	(*tmem_hostops.obj_free)(obj, pool);
+}
+
+/*
+ * free an object that has no more pampds in it; the memory is given back
+ * to the host after an rcu grace period
+ */
 static void tmem_obj_free(struct tmem_obj *obj, struct tmem_hashbucket *hb)
 {
 	struct tmem_pool *pool;
@@ -118,9 +172,9 @@ static void tmem_obj_free(struct tmem_obj *obj, struct tmem_hashbucket *hb)
 	atomic_dec(&pool->obj_count);
 	BUG_ON(atomic_read(&pool->obj_count) < 0);
 	INVERT_SENTINEL(obj, OBJ);
-	obj->pool = NULL;
 	tmem_oid_set_invalid(&obj->oid);
 	rb_erase(&obj->rb_tree_node, &hb->obj_rb_root);
+	call_rcu(&obj->rcu, tmem_obj_free_rcu);
 }
 
 /*
@@ -159,6 +213,9 @@ static void tmem_obj_init(struct tmem_obj *obj, struct tmem_hashbucket *hb,
 			break;
 		}
 	}
+	/* lockless readers may reach obj as soon as it is linked */
+	obj->rb_tree_node.rb_left = obj->rb_tree_node.rb_right = NULL;
+	smp_wmb();
 	rb_link_node(&obj->rb_tree_node, parent, new);
 	rb_insert_color(&obj->rb_tree_node, root);
 }
@@ -182,14 +239,15 @@ static void tmem_pool_flush(struct tmem_pool *pool, bool destroy)
 	BUG_ON(pool == NULL);
 	for (i = 0; i < TMEM_HASH_BUCKETS; i++, hb++) {
 		spin_lock(&hb->lock);
+		write_seqcount_begin(&hb->seq);
 		rbnode = rb_first(&hb->obj_rb_root);
 		while (rbnode != NULL) {
 			obj = rb_entry(rbnode, struct tmem_obj, rb_tree_node);
 			rbnode = rb_next(rbnode);
 			tmem_pampd_destroy_all_in_obj(obj);
 			tmem_obj_free(obj, hb);
-			(*tmem_hostops.obj_free)(obj, pool);
 		}
+		write_seqcount_end(&hb->seq);
 		spin_unlock(&hb->lock);
 	}
 	if (destroy)
@@ -246,11 +304,21 @@ static struct tmem_objnode *tmem_objnode_alloc(struct tmem_obj *obj)
 	SET_SENTINEL(objnode, OBJNODE);
 	memset(&objnode->slots, 0, sizeof(objnode->slots));
 	objnode->slots_in_use = 0;
+	objnode->pool = obj->pool;
 	obj->objnode_count++;
 out:
 	return objnode;
 }
 
+static void tmem_objnode_free_rcu(struct rcu_head *head)
+{
+	struct tmem_objnode *objnode =
+		container_of(head, struct tmem_objnode, rcu);
+
+	(*tmem_hostops.objnode_free)(objnode, objnode->pool);
+}
+
+/* all slots must be empty, lockless readers may still be looking at them */
 static void tmem_objnode_free(struct tmem_objnode *objnode)
 {
 	struct tmem_pool *pool;
@@ -268,7 +336,7 @@ static void tmem_objnode_free(struct tmem_objnode *objnode)
 	ASSERT_SENTINEL(pool, POOL);
 	objnode->obj->objnode_count--;
 	objnode->obj = NULL;
-	(*tmem_hostops.objnode_free)(objnode, pool);
+	call_rcu(&objnode->rcu, tmem_objnode_free_rcu);
 }
 
 /*
@@ -306,6 +374,52 @@ out:
 	return slot != NULL ? *slot : NULL;
 }
 
+/*
+ * Lockless check whether oid/index (or, if whole_obj, any index of oid)
+ * has no pampd in the hashbucket.  Returns true only if nothing changed
+ * the bucket while looking, so that the answer is as good as one given
+ * under the lock; false means the caller must take the lock and look.
+ * Must be called under rcu_read_lock.
+ *
+ * Objnodes never change level: trees grow and shrink at the root only.
+ * So once a consistent (root, height) pair is read, the walk down never
+ * mistakes a pampd for an objnode, and freed objnodes have empty slots.
+ */
+static bool tmem_pampd_absent(struct tmem_hashbucket *hb,
+				struct tmem_oid *oidp, uint32_t index,
+				bool whole_obj)
+{
+	struct tmem_obj *obj;
+	struct tmem_objnode *node;
+	unsigned int height, shift, seq;
+
+	seq = read_seqcount_begin(&hb->seq);
+	obj = tmem_obj_find_rcu(hb, oidp);
+	if (IS_ERR(obj))
+		return false;
+	if (obj == NULL)
+		goto out;
+	if (whole_obj)
+		return false;
+	height = ACCESS_ONCE(obj->objnode_tree_height);
+	node = rcu_dereference(obj->objnode_tree_root);
+	if (read_seqcount_retry(&hb->seq, seq))
+		return false;
+	if (index > tmem_objnode_tree_h2max[height])
+		goto out;
+	shift = height ? (height - 1) * OBJNODE_TREE_MAP_SHIFT : 0;
+	while (height > 0 && node != NULL) {
+		node = rcu_dereference(node->slots[(index >> shift) &
+						OBJNODE_TREE_MAP_MASK]);
+		shift -= OBJNODE_TREE_MAP_SHIFT;
+		height--;
+	}
+	if (node != NULL)
+		return false;
+out:
+	return !read_seqcount_retry(&hb->seq, seq);
+}
+
 static int tmem_pampd_add_to_obj(struct tmem_obj *obj, uint32_t index,
 					void *pampd)
 {
@@ -332,7 +446,7 @@ static int tmem_pampd_add_to_obj(struct tmem_obj *obj, uint32_t index,
 			}
 			newnode->slots[0] = obj->objnode_tree_root;
 			newnode->slots_in_use = 1;
-			obj->objnode_tree_root = newnode;
+			rcu_assign_pointer(obj->objnode_tree_root, newnode);
 			obj->objnode_tree_height++;
 		} while (height > obj->objnode_tree_height);
 	}
@@ -349,11 +463,12 @@ insert:
 				goto out;
 			}
 			if (objnode) {
-
-				objnode->slots[offset] = slot;
+				rcu_assign_pointer(objnode->slots[offset],
+							slot);
 				objnode->slots_in_use++;
 			} else
-				obj->objnode_tree_root = slot;
+				rcu_assign_pointer(obj->objnode_tree_root,
+							slot);
 		}
 		/* go down a level */
 		offset = (index >> shift) & OBJNODE_TREE_MAP_MASK;
@@ -483,6 +598,18 @@ static void tmem_pampd_destroy_all_in_obj(struct tmem_obj *obj)
 	obj->objnode_tree_root = NULL;
 }
 
+static bool tmem_absent_unlocked(struct tmem_hashbucket *hb,
+				struct tmem_oid *oidp, uint32_t index,
+				bool whole_obj)
+{
+	bool absent;
+
+	rcu_read_lock();
+	absent = tmem_pampd_absent(hb, oidp, index, whole_obj);
+	rcu_read_unlock();
+	return absent;
+}
+
 /*
  * Tmem is operated on by a set of well-defined actions:
  * "put", "get", "flush", "flush_object", "new pool" and "destroy pool".
@@ -519,7 +646,9 @@ int tmem_put(struct tmem_pool *pool, struct tmem_oid *oidp, uint32_t index,
 		pampd = tmem_pampd_lookup_in_obj(objfound, index);
 		if (pampd != NULL) {
 			/* if found, is a dup put, flush the old one */
+			write_seqcount_begin(&hb->seq);
 			pampd_del = tmem_pampd_delete_from_obj(obj, index);
+			write_seqcount_end(&hb->seq);
 			BUG_ON(pampd_del != pampd);
 			(*tmem_pamops.free)(pampd, pool);
 			if (obj->pampd_count == 0) {
@@ -534,28 +663,31 @@ int tmem_put(struct tmem_pool *pool, struct tmem_oid *oidp, uint32_t index,
 			ret = -ENOMEM;
 			goto out;
 		}
+		write_seqcount_begin(&hb->seq);
 		tmem_obj_init(obj, hb, pool, oidp);
+		write_seqcount_end(&hb->seq);
 	}
 	BUG_ON(obj == NULL);
 	BUG_ON(((objnew != obj) && (objfound != obj)) || (objnew == objfound));
 	pampd = (*tmem_pamops.create)(obj->pool, &obj->oid, index, page);
+	write_seqcount_begin(&hb->seq);
 	if (unlikely(pampd == NULL))
 		goto free;
 	ret = tmem_pampd_add_to_obj(obj, index, pampd);
 	if (unlikely(ret == -ENOMEM))
 		/* may have partially built objnode tree ("stump") */
 		goto delete_and_free;
-	goto out;
+	goto out_seq;
 
 delete_and_free:
 	(void)tmem_pampd_delete_from_obj(obj, index);
 free:
 	if (pampd)
 		(*tmem_pamops.free)(pampd, pool);
-	if (objnew) {
+	if (objnew)
 		tmem_obj_free(objnew, hb);
-		(*tmem_hostops.obj_free)(objnew, pool);
-	}
+out_seq:
+	write_seqcount_end(&hb->seq);
 out:
 	spin_unlock(&hb->lock);
 	return ret;
@@ -583,14 +715,18 @@ int tmem_get(struct tmem_pool *pool, struct tmem_oid *oidp,
 	struct tmem_hashbucket *hb;
 
 	hb = &pool->hashbucket[tmem_oid_hash(oidp)];
+	if (tmem_absent_unlocked(hb, oidp, index, false))
+		return ret;
 	spin_lock(&hb->lock);
 	obj = tmem_obj_find(hb, oidp);
 	if (obj == NULL)
 		goto out;
 	ephemeral = is_ephemeral(pool);
-	if (ephemeral)
+	if (ephemeral) {
+		write_seqcount_begin(&hb->seq);
 		pampd = tmem_pampd_delete_from_obj(obj, index);
-	else
+		write_seqcount_end(&hb->seq);
+	} else
 		pampd = tmem_pampd_lookup_in_obj(obj, index);
 	if (pampd == NULL)
 		goto out;
@@ -600,8 +736,9 @@ int tmem_get(struct tmem_pool *pool, struct tmem_oid *oidp,
 	if (ephemeral) {
 		(*tmem_pamops.free)(pampd, pool);
 		if (obj->pampd_count == 0) {
+			write_seqcount_begin(&hb->seq);
 			tmem_obj_free(obj, hb);
-			(*tmem_hostops.obj_free)(obj, pool);
+			write_seqcount_end(&hb->seq);
 			obj = NULL;
 		}
 	}
@@ -625,7 +762,10 @@ int tmem_flush_page(struct tmem_pool *pool,
 	struct tmem_hashbucket *hb;
 
 	hb = &pool->hashbucket[tmem_oid_hash(oidp)];
+	if (tmem_absent_unlocked(hb, oidp, index, false))
+		return ret;
 	spin_lock(&hb->lock);
+	write_seqcount_begin(&hb->seq);
 	obj = tmem_obj_find(hb, oidp);
 	if (obj == NULL)
 		goto out;
@@ -633,13 +773,12 @@ int tmem_flush_page(struct tmem_pool *pool,
 	if (pampd == NULL)
 		goto out;
 	(*tmem_pamops.free)(pampd, pool);
-	if (obj->pampd_count == 0) {
+	if (obj->pampd_count == 0)
 		tmem_obj_free(obj, hb);
-		(*tmem_hostops.obj_free)(obj, pool);
-	}
 	ret = 0;
 
 out:
+	write_seqcount_end(&hb->seq);
 	spin_unlock(&hb->lock);
 	return ret;
 }
@@ -654,23 +793,28 @@ int tmem_flush_object(struct tmem_pool *pool, struct tmem_oid *oidp)
 	int ret = -1;
 
 	hb = &pool->hashbucket[tmem_oid_hash(oidp)];
+	if (tmem_absent_unlocked(hb, oidp, 0, true))
+		return ret;
 	spin_lock(&hb->lock);
+	write_seqcount_begin(&hb->seq);
 	obj = tmem_obj_find(hb, oidp);
 	if (obj == NULL)
 		goto out;
 	tmem_pampd_destroy_all_in_obj(obj);
 	tmem_obj_free(obj, hb);
-	(*tmem_hostops.obj_free)(obj, pool);
 	ret = 0;
 
 out:
+	write_seqcount_end(&hb->seq);
 	spin_unlock(&hb->lock);
 	return ret;
 }
 
 /*
  * "Flush" all pages (and tmem_objs) from this tmem_pool and disable
- * all subsequent access to this tmem_pool.
+ * all subsequent access to this tmem_pool.  Objects are handed back to
+ * the host after a grace period, so the caller must rcu_barrier() before
+ * freeing the pool.
  */
 int tmem_destroy_pool(struct tmem_pool *pool)
 {
@@ -700,6 +844,7 @@ void tmem_new_pool(struct tmem_pool *pool, uint32_t flags)
 	for (i = 0; i < TMEM_HASH_BUCKETS; i++, hb++) {
 		hb->obj_rb_root = RB_ROOT;
 		spin_lock_init(&hb->lock);
+		seqcount_init(&hb->seq);
 	}
 	INIT_LIST_HEAD(&pool->pool_list);
 	atomic_set(&pool->obj_count, 0);
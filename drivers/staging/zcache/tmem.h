@@ -12,6 +12,8 @@
 #include <linux/types.h>
 #include <linux/highmem.h>
 #include <linux/hash.h>
+#include <linux/rcupdate.h>
+#include <linux/seqlock.h>
 #include <linux/atomic.h>
 
 /*
@@ -54,7 +56,9 @@
  * usually corresponds to a large independent set of pages such as
  * a filesystem.  Each pool has an id, and certain attributes and counters.
  * It also contains a set of hash buckets, each of which contains an rbtree
- * of objects and a lock to manage concurrency within the pool.
+ * of objects and a lock to manage concurrency within the pool.  The
+ * sequence count is bumped around every change to the rbtree or to the
+ * objnode trees of its objects, so lookups can be done locklessly.
  */
 
 #define TMEM_HASH_BUCKET_BITS	8
@@ -63,6 +67,7 @@
 struct tmem_hashbucket {
 	struct rb_root obj_rb_root;
 	spinlock_t lock;
+	seqcount_t seq;
 };
 
 struct tmem_pool {
@@ -147,6 +152,7 @@ struct tmem_obj {
 	unsigned int objnode_tree_height;
 	unsigned long objnode_count;
 	long pampd_count;
+	struct rcu_head rcu;
 	DECL_SENTINEL
 };
 
@@ -162,6 +168,8 @@ struct tmem_objnode {
 	DECL_SENTINEL
 	void *slots[OBJNODE_TREE_MAP_SIZE];
 	unsigned int slots_in_use;
+	struct tmem_pool *pool; /* for the rcu callback */
+	struct rcu_head rcu;
 };
 
 /* pampd abstract datatype methods provided by the PAM implementation */
@@ -173,7 +181,10 @@ struct tmem_pamops {
 };
 extern void tmem_register_pamops(struct tmem_pamops *m);
 
-/* memory allocation methods provided by the host implementation */
+/*
+ * memory allocation methods provided by the host implementation;
+ * obj_free and objnode_free are called from rcu callbacks
+ */
 struct tmem_hostops {
 	struct tmem_obj *(*obj_alloc)(struct tmem_pool *);
 	void (*obj_free)(struct tmem_obj *, struct tmem_pool *);
@@ -6,23 +6,24 @@
  *
  * Zcache provides an in-kernel "host implementation" for transcendent memory
  * and, thus indirectly, for cleancache and frontswap.  Zcache includes two
- * page-accessible memory [1] interfaces, both utilizing lzo1x compression:
+ * page-accessible memory [1] interfaces, both utilizing a compressor from
+ * the crypto API (lzo1x by default, see the "zcache=" boot parameter):
  * 1) "compression buddies" ("zbud") is used for ephemeral pages
  * 2) xvmalloc is used for persistent pages.
  * Xvmalloc (based on the TLSF allocator) has very low fragmentation
- * so maximizes space efficiency, while zbud allows pairs (and potentially,
- * in the future, more than a pair of) compressed pages to be closely linked
- * so that reclaiming can be done via the kernel's physical-page-oriented
- * "shrinker" interface.
+ * so maximizes space efficiency, while zbud allows a few compressed pages
+ * to be closely linked so that reclaiming can be done via the kernel's
+ * physical-page-oriented "shrinker" interface.
  *
  * [1] For a definition of page-accessible memory (aka PAM), see:
  *   http://marc.info/?l=linux-mm&m=127811271605009
  */
 
 #include <linux/cpu.h>
+#include <linux/crypto.h>
 #include <linux/highmem.h>
+#include <linux/hrtimer.h>
 #include <linux/list.h>
-#include <linux/lzo.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
 #include <linux/types.h>
@@ -49,33 +50,70 @@
 	(__GFP_FS | __GFP_NORETRY | __GFP_NOWARN | __GFP_NOMEMALLOC)
 #endif
 
+/*
+ * Each cpu has its own crypto_comp transform for the selected compressor,
+ * as transforms may not be used concurrently.  Callers must not sleep
+ * between zcache_comp_op() and using its output.
+ */
+#define ZCACHE_COMP_NAME_DEFAULT "lzo"
+static char zcache_comp_name[CRYPTO_MAX_ALG_NAME];
+static DEFINE_PER_CPU(struct crypto_comp *, zcache_comp_tfm);
+
+enum comp_op {
+	ZCACHE_COMPOP_COMPRESS,
+	ZCACHE_COMPOP_DECOMPRESS
+};
+
+static int zcache_comp_op(enum comp_op op, const u8 *src, unsigned int slen,
+				u8 *dst, unsigned int *dlen)
+{
+	struct crypto_comp *tfm;
+	int ret;
+
+	tfm = get_cpu_var(zcache_comp_tfm);
+	if (unlikely(tfm == NULL)) {
+		ret = -ENODEV;
+		goto out;
+	}
+	if (op == ZCACHE_COMPOP_COMPRESS)
+		ret = crypto_comp_compress(tfm, src, slen, dst, dlen);
+	else
+		ret = crypto_comp_decompress(tfm, src, slen, dst, dlen);
+out:
+	put_cpu_var(zcache_comp_tfm);
+	return ret;
+}
+
 /**********
- * Compression buddies ("zbud") provides for packing two (or, possibly
- * in the future, more) compressed ephemeral pages into a single "raw"
- * (physical) page and tracking them with data structures so that
- * the raw pages can be easily reclaimed.
+ * Compression buddies ("zbud") provides for packing up to ZBUD_MAX_BUDS
+ * compressed ephemeral pages into a single "raw" (physical) page and
+ * tracking them with data structures so that the raw pages can be easily
+ * reclaimed.
  *
  * A zbud page ("zbpg") is an aligned page containing a list_head,
- * a lock, and two "zbud headers".  The remainder of the physical
- * page is divided up into aligned 64-byte "chunks" which contain
- * the compressed data for zero, one, or two zbuds.  Each zbpg
- * resides on: (1) an "unused list" if it has no zbuds; (2) a
- * "buddied" list if it is fully populated  with two zbuds; or
- * (3) one of PAGE_SIZE/64 "unbuddied" lists indexed by how many chunks
- * the one unbuddied zbud uses.  The data inside a zbpg cannot be
- * read or written unless the zbpg's lock is held.
+ * a lock, and ZBUD_MAX_BUDS "zbud headers".  The remainder of the physical
+ * page is divided up into aligned 64-byte "chunks" which contain the
+ * compressed data for the zbuds in use; each header records the chunk its
+ * data starts at.  New data is appended after the last zbud and the page
+ * is compacted in place when the free chunks are not contiguous.  Each
+ * zbpg resides on: (1) an "unused list" if it has no zbuds; (2) a
+ * "buddied" list if it is full, i.e. all headers or all chunks are in use;
+ * or (3) one of PAGE_SIZE/64 "unbuddied" lists indexed by how many chunks
+ * its zbuds use.  The data inside a zbpg cannot be read or written unless
+ * the zbpg's lock is held.
  */
 
 #define ZBH_SENTINEL  0x43214321
 #define ZBPG_SENTINEL  0xdeadbeef
 
-#define ZBUD_MAX_BUDS 2
+#define ZBUD_MAX_BUDS 4
 
 struct zbud_hdr {
 	uint32_t pool_id;
 	struct tmem_oid oid;
 	uint32_t index;
 	uint16_t size; /* compressed size in bytes, zero means unused */
+	uint16_t chunk; /* first data chunk */
 	DECL_SENTINEL
 };
 
@@ -93,6 +131,8 @@ struct zbud_page {
 #define NCHUNKS		(((PAGE_SIZE - sizeof(struct zbud_page)) & \
 				CHUNK_MASK) >> CHUNK_SHIFT)
 #define MAX_CHUNK	(NCHUNKS-1)
+#define ZBUD_DATA_START	((sizeof(struct zbud_page) + CHUNK_SIZE - 1) & \
+				CHUNK_MASK)
 
 static struct {
 	struct list_head list;
@@ -119,6 +159,7 @@ static atomic_t zcache_zbud_curr_zpages;
 static unsigned long zcache_zbud_curr_zbytes;
 static unsigned long zcache_zbud_cumul_zpages;
 static unsigned long zcache_zbud_cumul_zbytes;
+static unsigned long zcache_zbud_compactions;
 static unsigned long zcache_compress_poor;
 
 /* forward references */
@@ -159,21 +200,112 @@ static inline int zbud_budnum(struct zbud_hdr *zh)
 static char *zbud_data(struct zbud_hdr *zh, unsigned size)
 {
 	struct zbud_page *zbpg;
-	char *p;
 	unsigned budnum;
 
 	ASSERT_SENTINEL(zh, ZBH);
 	budnum = zbud_budnum(zh);
 	BUG_ON(size == 0 || size > zbud_max_buddy_size());
+	BUG_ON(zh->chunk + zbud_size_to_chunks(size) > NCHUNKS);
 	zbpg = container_of(zh, struct zbud_page, buddy[budnum]);
 	ASSERT_SPINLOCK(&zbpg->lock);
-	p = (char *)zbpg;
-	if (budnum == 0)
-		p += ((sizeof(struct zbud_page) + CHUNK_SIZE - 1) &
-							CHUNK_MASK);
-	else if (budnum == 1)
-		p += PAGE_SIZE - ((size + CHUNK_SIZE - 1) & CHUNK_MASK);
-	return p;
+	return (char *)zbpg + ZBUD_DATA_START + (zh->chunk << CHUNK_SHIFT);
+}
+
+/*
+ * Count the zbuds in use in a zbpg and the chunks they occupy.  The
+ * caller must hold the zbpg's lock.
+ */
+static unsigned zbud_used_chunks(struct zbud_page *zbpg, int *nbuds)
+{
+	unsigned chunks = 0;
+	int i, n = 0;
+
+	for (i = 0; i < ZBUD_MAX_BUDS; i++)
+		if (zbpg->buddy[i].size) {
+			chunks += zbud_size_to_chunks(zbpg->buddy[i].size);
+			n++;
+		}
+	if (nbuds != NULL)
+		*nbuds = n;
+	return chunks;
+}
+
+/*
+ * Put a zbpg that has at least one zbud on the list matching its state,
+ * or take it off that list.  The caller must hold the zbpg's lock and
+ * zbud_budlists_spinlock.
+ */
+static void zbud_list_add(struct zbud_page *zbpg)
+{
+	int nbuds;
+	unsigned chunks = zbud_used_chunks(zbpg, &nbuds);
+
+	BUG_ON(nbuds == 0);
+	if (nbuds == ZBUD_MAX_BUDS || chunks == NCHUNKS) {
+		list_add_tail(&zbpg->bud_list, &zbud_buddied_list);
+		zcache_zbud_buddied_count++;
+	} else {
+		list_add_tail(&zbpg->bud_list, &zbud_unbuddied[chunks].list);
+		zbud_unbuddied[chunks].count++;
+	}
+}
+
+static void zbud_list_del(struct zbud_page *zbpg)
+{
+	int nbuds;
+	unsigned chunks = zbud_used_chunks(zbpg, &nbuds);
+
+	BUG_ON(list_empty(&zbpg->bud_list));
+	list_del_init(&zbpg->bud_list);
+	if (nbuds == ZBUD_MAX_BUDS || chunks == NCHUNKS)
+		zcache_zbud_buddied_count--;
+	else
+		zbud_unbuddied[chunks].count--;
+}
+
+/*
+ * Find nchunks free contiguous chunks in a zbpg that is known to have
+ * that many free chunks in total, and return the first one.  If the free
+ * space after the last zbud is too small, slide all zbuds down to the
+ * start of the data area first.  The caller must hold the zbpg's lock.
+ */
+static unsigned zbud_make_room(struct zbud_page *zbpg, unsigned nchunks)
+{
+	struct zbud_hdr *zh, *sorted[ZBUD_MAX_BUDS];
+	char *base = (char *)zbpg + ZBUD_DATA_START;
+	unsigned end = 0, chunks;
+	int i, j, n = 0;
+
+	for (i = 0; i < ZBUD_MAX_BUDS; i++) {
+		zh = &zbpg->buddy[i];
+		if (zh->size == 0)
+			continue;
+		chunks = zbud_size_to_chunks(zh->size);
+		if (zh->chunk + chunks > end)
+			end = zh->chunk + chunks;
+		/* keep sorted[] ordered by position in the page */
+		for (j = n++; j > 0 && sorted[j - 1]->chunk > zh->chunk; j--)
+			sorted[j] = sorted[j - 1];
+		sorted[j] = zh;
+	}
+	if (NCHUNKS - end >= nchunks)
+		return end;
+
+	end = 0;
+	for (i = 0; i < n; i++) {
+		zh = sorted[i];
+		chunks = zbud_size_to_chunks(zh->size);
+		if (zh->chunk != end) {
+			memmove(base + (end << CHUNK_SHIFT),
+				base + (zh->chunk << CHUNK_SHIFT),
+				chunks << CHUNK_SHIFT);
+			zh->chunk = end;
+		}
+		end += chunks;
+	}
+	zcache_zbud_compactions++;
+	BUG_ON(NCHUNKS - end < nchunks);
+	return end;
 }
 
 /*
@@ -183,8 +315,9 @@ static char *zbud_data(struct zbud_hdr *zh, unsigned size)
 static struct zbud_page *zbud_alloc_raw_page(void)
 {
 	struct zbud_page *zbpg = NULL;
-	struct zbud_hdr *zh0, *zh1;
+	struct zbud_hdr *zh;
 	bool recycled = 0;
+	int i;
 
 	/* if any pages on the zbpg list, use one */
 	spin_lock(&zbpg_unused_list_spinlock);
@@ -201,20 +334,24 @@ static struct zbud_page *zbud_alloc_raw_page(void)
 		zbpg = zcache_get_free_page();
 	if (likely(zbpg != NULL)) {
 		INIT_LIST_HEAD(&zbpg->bud_list);
-		zh0 = &zbpg->buddy[0]; zh1 = &zbpg->buddy[1];
 		spin_lock_init(&zbpg->lock);
 		if (recycled) {
 			ASSERT_INVERTED_SENTINEL(zbpg, ZBPG);
 			SET_SENTINEL(zbpg, ZBPG);
-			BUG_ON(zh0->size != 0 || tmem_oid_valid(&zh0->oid));
-			BUG_ON(zh1->size != 0 || tmem_oid_valid(&zh1->oid));
+			for (i = 0; i < ZBUD_MAX_BUDS; i++) {
+				zh = &zbpg->buddy[i];
+				BUG_ON(zh->size != 0 ||
+					tmem_oid_valid(&zh->oid));
+			}
 		} else {
 			atomic_inc(&zcache_zbud_curr_raw_pages);
 			INIT_LIST_HEAD(&zbpg->bud_list);
 			SET_SENTINEL(zbpg, ZBPG);
-			zh0->size = 0; zh1->size = 0;
-			tmem_oid_set_invalid(&zh0->oid);
-			tmem_oid_set_invalid(&zh1->oid);
+			for (i = 0; i < ZBUD_MAX_BUDS; i++) {
+				zh = &zbpg->buddy[i];
+				zh->size = 0;
+				tmem_oid_set_invalid(&zh->oid);
+			}
 		}
 	}
 	return zbpg;
@@ -222,13 +359,16 @@ static struct zbud_page *zbud_alloc_raw_page(void)
 
 static void zbud_free_raw_page(struct zbud_page *zbpg)
 {
-	struct zbud_hdr *zh0 = &zbpg->buddy[0], *zh1 = &zbpg->buddy[1];
+	struct zbud_hdr *zh;
+	int i;
 
 	ASSERT_SENTINEL(zbpg, ZBPG);
 	BUG_ON(!list_empty(&zbpg->bud_list));
 	ASSERT_SPINLOCK(&zbpg->lock);
-	BUG_ON(zh0->size != 0 || tmem_oid_valid(&zh0->oid));
-	BUG_ON(zh1->size != 0 || tmem_oid_valid(&zh1->oid));
+	for (i = 0; i < ZBUD_MAX_BUDS; i++) {
+		zh = &zbpg->buddy[i];
+		BUG_ON(zh->size != 0 || tmem_oid_valid(&zh->oid));
+	}
 	INVERT_SENTINEL(zbpg, ZBPG);
 	spin_unlock(&zbpg->lock);
 	spin_lock(&zbpg_unused_list_spinlock);
@@ -259,11 +399,10 @@ static unsigned zbud_free(struct zbud_hdr *zh)
 
 static void zbud_free_and_delist(struct zbud_hdr *zh)
 {
-	unsigned chunks;
-	struct zbud_hdr *zh_other;
-	unsigned budnum = zbud_budnum(zh), size;
+	unsigned budnum = zbud_budnum(zh);
 	struct zbud_page *zbpg =
 		container_of(zh, struct zbud_page, buddy[budnum]);
+	int nbuds;
 
 	spin_lock(&zbpg->lock);
 	if (list_empty(&zbpg->bud_list)) {
@@ -271,24 +410,15 @@ static void zbud_free_and_delist(struct zbud_hdr *zh)
 		spin_unlock(&zbpg->lock);
 		return;
 	}
-	size = zbud_free(zh);
-	ASSERT_SPINLOCK(&zbpg->lock);
-	zh_other = &zbpg->buddy[(budnum == 0) ? 1 : 0];
-	if (zh_other->size == 0) { /* was unbuddied: unlist and free */
-		chunks = zbud_size_to_chunks(size) ;
-		spin_lock(&zbud_budlists_spinlock);
-		BUG_ON(list_empty(&zbud_unbuddied[chunks].list));
-		list_del_init(&zbpg->bud_list);
-		zbud_unbuddied[chunks].count--;
+	spin_lock(&zbud_budlists_spinlock);
+	zbud_list_del(zbpg);
+	zbud_free(zh);
+	zbud_used_chunks(zbpg, &nbuds);
+	if (nbuds == 0) { /* was the last zbud: free the page */
 		spin_unlock(&zbud_budlists_spinlock);
 		zbud_free_raw_page(zbpg);
-	} else { /* was buddied: move remaining buddy to unbuddied list */
-		chunks = zbud_size_to_chunks(zh_other->size) ;
-		spin_lock(&zbud_budlists_spinlock);
-		list_del_init(&zbpg->bud_list);
-		zcache_zbud_buddied_count--;
-		list_add_tail(&zbpg->bud_list, &zbud_unbuddied[chunks].list);
-		zbud_unbuddied[chunks].count++;
+	} else { /* move to the list for the remaining zbuds */
+		zbud_list_add(zbpg);
 		spin_unlock(&zbud_budlists_spinlock);
 		spin_unlock(&zbpg->lock);
 	}
@@ -298,11 +428,11 @@ static struct zbud_hdr *zbud_create(uint32_t pool_id, struct tmem_oid *oid,
 					uint32_t index, struct page *page,
 					void *cdata, unsigned size)
 {
-	struct zbud_hdr *zh0, *zh1, *zh = NULL;
+	struct zbud_hdr *zh = NULL;
 	struct zbud_page *zbpg = NULL, *ztmp;
-	unsigned nchunks;
+	unsigned nchunks, chunk = 0;
 	char *to;
-	int i, found_good_buddy = 0;
+	int i;
 
 	nchunks = zbud_size_to_chunks(size) ;
 	for (i = MAX_CHUNK - nchunks + 1; i > 0; i--) {
@@ -310,10 +440,8 @@ static struct zbud_hdr *zbud_create(uint32_t pool_id, struct tmem_oid *oid,
 		if (!list_empty(&zbud_unbuddied[i].list)) {
 			list_for_each_entry_safe(zbpg, ztmp,
 				    &zbud_unbuddied[i].list, bud_list) {
-				if (spin_trylock(&zbpg->lock)) {
-					found_good_buddy = i;
+				if (spin_trylock(&zbpg->lock))
 					goto found_unbuddied;
-				}
 			}
 		}
 		spin_unlock(&zbud_budlists_spinlock);
@@ -322,42 +450,40 @@ static struct zbud_hdr *zbud_create(uint32_t pool_id, struct tmem_oid *oid,
 	zbpg = zbud_alloc_raw_page();
 	if (unlikely(zbpg == NULL))
 		goto out;
-	/* ok, have a page, now compress the data before taking locks */
 	spin_lock(&zbpg->lock);
-	spin_lock(&zbud_budlists_spinlock);
-	list_add_tail(&zbpg->bud_list, &zbud_unbuddied[nchunks].list);
-	zbud_unbuddied[nchunks].count++;
 	zh = &zbpg->buddy[0];
 	goto init_zh;
 
 found_unbuddied:
 	ASSERT_SPINLOCK(&zbpg->lock);
-	zh0 = &zbpg->buddy[0]; zh1 = &zbpg->buddy[1];
-	BUG_ON(!((zh0->size == 0) ^ (zh1->size == 0)));
-	if (zh0->size != 0) { /* buddy0 in use, buddy1 is vacant */
-		ASSERT_SENTINEL(zh0, ZBH);
-		zh = zh1;
-	} else if (zh1->size != 0) { /* buddy1 in use, buddy0 is vacant */
-		ASSERT_SENTINEL(zh1, ZBH);
-		zh = zh0;
-	} else
-		BUG();
-	list_del_init(&zbpg->bud_list);
-	zbud_unbuddied[found_good_buddy].count--;
-	list_add_tail(&zbpg->bud_list, &zbud_buddied_list);
-	zcache_zbud_buddied_count++;
+	/*
+	 * Off the lists, the page looks like a zombie to anyone else who
+	 * gets its lock, so it must be relisted before the lock is dropped.
+	 */
+	zbud_list_del(zbpg);
+	spin_unlock(&zbud_budlists_spinlock);
+	for (i = 0; i < ZBUD_MAX_BUDS; i++) {
+		zh = &zbpg->buddy[i];
+		if (zh->size == 0)
+			break;
+		ASSERT_SENTINEL(zh, ZBH);
+	}
+	BUG_ON(i == ZBUD_MAX_BUDS);
+	/* may move the other zbuds, so do it before taking list locks */
+	chunk = zbud_make_room(zbpg, nchunks);
 
 init_zh:
 	SET_SENTINEL(zh, ZBH);
 	zh->size = size;
+	zh->chunk = chunk;
 	zh->index = index;
 	zh->oid = *oid;
 	zh->pool_id = pool_id;
-	/* can wait to copy the data until the list locks are dropped */
-	spin_unlock(&zbud_budlists_spinlock);
-
 	to = zbud_data(zh, size);
 	memcpy(to, cdata, size);
+	spin_lock(&zbud_budlists_spinlock);
+	zbud_list_add(zbpg);
+	spin_unlock(&zbud_budlists_spinlock);
 	spin_unlock(&zbpg->lock);
 	zbud_cumul_chunk_counts[nchunks]++;
 	atomic_inc(&zcache_zbud_curr_zpages);
@@ -372,7 +498,7 @@ static int zbud_decompress(struct page *page, struct zbud_hdr *zh)
 {
 	struct zbud_page *zbpg;
 	unsigned budnum = zbud_budnum(zh);
-	size_t out_len = PAGE_SIZE;
+	unsigned int out_len = PAGE_SIZE;
 	char *to_va, *from_va;
 	unsigned size;
 	int ret = 0;
@@ -389,8 +515,9 @@ static int zbud_decompress(struct page *page, struct zbud_hdr *zh)
 	to_va = kmap_atomic(page, KM_USER0);
 	size = zh->size;
 	from_va = zbud_data(zh, size);
-	ret = lzo1x_decompress_safe(from_va, size, to_va, &out_len);
-	BUG_ON(ret != LZO_E_OK);
+	ret = zcache_comp_op(ZCACHE_COMPOP_DECOMPRESS, from_va, size,
+				to_va, &out_len);
+	BUG_ON(ret);
 	BUG_ON(out_len != PAGE_SIZE);
 	kunmap_atomic(to_va, KM_USER0);
 out:
@@ -409,6 +536,7 @@ static unsigned long zcache_evicted_unbuddied_pages;
 
 static struct tmem_pool *zcache_get_pool_by_id(uint32_t poolid);
 static void zcache_put_pool(struct tmem_pool *pool);
+static void zcache_count_eviction(uint32_t poolid);
 
 /*
  * Flush and free all zbuds in a zbpg, then free the pageframe
@@ -437,6 +565,7 @@ static void zbud_evict_zbpg(struct zbud_page *zbpg)
 	for (i = 0; i < j; i++) {
 		pool = zcache_get_pool_by_id(pool_id[i]);
 		if (pool != NULL) {
+			zcache_count_eviction(pool_id[i]);
 			tmem_flush_page(pool, &oid[i], index[i]);
 			zcache_put_pool(pool);
 		}
@@ -479,7 +608,7 @@ retry_unused_list:
 	spin_unlock_bh(&zbpg_unused_list_spinlock);
 
 	/* now try freeing unbuddied pages, starting with least space avail */
-	for (i = 0; i < MAX_CHUNK; i++) {
+	for (i = 0; i < NCHUNKS; i++) {
 retry_unbud_list_i:
 		spin_lock_bh(&zbud_budlists_spinlock);
 		if (list_empty(&zbud_unbuddied[i].list)) {
@@ -586,7 +715,7 @@ static int zbud_show_cumul_chunk_counts(char *buf)
 
 /**********
  * This "zv" PAM implementation combines the TLSF-based xvMalloc
- * with lzo1x compression to maximize the amount of data that can
+ * with compression to maximize the amount of data that can
  * be packed into a physical page.
  *
  * Zv represents a PAM page with the index and object (plus a "size" value
@@ -649,7 +778,7 @@ static void zv_free(struct xv_pool *xvpool, struct zv_hdr *zv)
 
 static void zv_decompress(struct page *page, struct zv_hdr *zv)
 {
-	size_t clen = PAGE_SIZE;
+	unsigned int clen = PAGE_SIZE;
 	char *to_va;
 	unsigned size;
 	int ret;
@@ -658,10 +787,10 @@ static void zv_decompress(struct page *page, struct zv_hdr *zv)
 	size = xv_get_object_size(zv) - sizeof(*zv);
 	BUG_ON(size == 0 || size > zv_max_page_size);
 	to_va = kmap_atomic(page, KM_USER0);
-	ret = lzo1x_decompress_safe((char *)zv + sizeof(*zv),
-					size, to_va, &clen);
+	ret = zcache_comp_op(ZCACHE_COMPOP_DECOMPRESS, (char *)zv + sizeof(*zv),
+				size, to_va, &clen);
 	kunmap_atomic(to_va, KM_USER0);
-	BUG_ON(ret != LZO_E_OK);
+	BUG_ON(ret);
 	BUG_ON(clen != PAGE_SIZE);
 }
 
@@ -679,11 +808,40 @@ static unsigned long zcache_failed_pers_puts;
 
 #define MAX_POOLS_PER_CLIENT 16
 
+/*
+ * Per-pool counters, reset when a pool id is (re)used.  Like the global
+ * counters above they are updated without locking.  Bucket 0 of the
+ * latency histograms counts operations that took less than 1us, bucket
+ * i > 0 those that took [2^(i-1), 2^i) us; the last bucket also counts
+ * everything slower.
+ */
+#define ZCACHE_LAT_BUCKETS 16
+
+struct zcache_pool_stats {
+	unsigned long puts;
+	unsigned long failed_puts;
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long flushes;
+	unsigned long evictions;
+	unsigned long put_lat[ZCACHE_LAT_BUCKETS];
+	unsigned long get_lat[ZCACHE_LAT_BUCKETS];
+};
+
 static struct {
 	struct tmem_pool *tmem_pools[MAX_POOLS_PER_CLIENT];
+	struct zcache_pool_stats pool_stats[MAX_POOLS_PER_CLIENT];
 	struct xv_pool *xvpool;
 } zcache_client;
 
+static void zcache_lat_account(unsigned long *hist, ktime_t start)
+{
+	s64 us = ktime_us_delta(ktime_get(), start);
+	int i = us > 0 ? fls64(us) : 0;
+
+	hist[min(i, ZCACHE_LAT_BUCKETS - 1)]++;
+}
+
 /*
  * Tmem operations assume the poolid implies the invoking client.
  * Zcache only has one client (the kernel itself), so translate
@@ -709,6 +867,11 @@ static void zcache_put_pool(struct tmem_pool *pool)
 		atomic_dec(&pool->refcount);
 }
 
+static void zcache_count_eviction(uint32_t poolid)
+{
+	zcache_client.pool_stats[poolid].evictions++;
+}
+
 /* counters for debugging */
 static unsigned long zcache_failed_get_free_pages;
 static unsigned long zcache_failed_alloc;
@@ -899,13 +1062,14 @@ static atomic_t zcache_curr_pers_pampd_count = ATOMIC_INIT(0);
 static unsigned long zcache_curr_pers_pampd_count_max;
 
 /* forward reference */
-static int zcache_compress(struct page *from, void **out_va, size_t *out_len);
+static int zcache_compress(struct page *from, void **out_va,
+				unsigned int *out_len);
 
 static void *zcache_pampd_create(struct tmem_pool *pool, struct tmem_oid *oid,
 				 uint32_t index, struct page *page)
 {
 	void *pampd = NULL, *cdata;
-	size_t clen;
+	unsigned int clen;
 	int ret;
 	bool ephemeral = is_ephemeral(pool);
 	unsigned long count;
@@ -997,55 +1161,82 @@ static struct tmem_pamops zcache_pamops = {
  * zcache compression/decompression and related per-cpu stuff
  */
 
-#define LZO_WORKMEM_BYTES LZO1X_1_MEM_COMPRESS
-#define LZO_DSTMEM_PAGE_ORDER 1
-static DEFINE_PER_CPU(unsigned char *, zcache_workmem);
+#define ZCACHE_DSTMEM_ORDER 1
 static DEFINE_PER_CPU(unsigned char *, zcache_dstmem);
 
-static int zcache_compress(struct page *from, void **out_va, size_t *out_len)
+static int zcache_compress(struct page *from, void **out_va,
+				unsigned int *out_len)
 {
 	int ret = 0;
 	unsigned char *dmem = __get_cpu_var(zcache_dstmem);
-	unsigned char *wmem = __get_cpu_var(zcache_workmem);
 	char *from_va;
 
 	BUG_ON(!irqs_disabled());
-	if (unlikely(dmem == NULL || wmem == NULL))
+	if (unlikely(dmem == NULL))
 		goto out;  /* no buffer, so can't compress */
 	from_va = kmap_atomic(from, KM_USER0);
 	mb();
-	ret = lzo1x_1_compress(from_va, PAGE_SIZE, dmem, out_len, wmem);
-	BUG_ON(ret != LZO_E_OK);
-	*out_va = dmem;
+	*out_len = PAGE_SIZE << ZCACHE_DSTMEM_ORDER;
+	ret = zcache_comp_op(ZCACHE_COMPOP_COMPRESS, from_va, PAGE_SIZE,
+				dmem, out_len);
 	kunmap_atomic(from_va, KM_USER0);
+	if (ret) {
+		/* treat like an incompressible page */
+		ret = 0;
+		goto out;
+	}
+	*out_va = dmem;
 	ret = 1;
 out:
 	return ret;
 }
 
+static int __init zcache_comp_init(void)
+{
+	if (*zcache_comp_name != '\0' &&
+	    !crypto_has_comp(zcache_comp_name, 0, 0)) {
+		pr_info("zcache: %s compressor not supported\n",
+			zcache_comp_name);
+		*zcache_comp_name = '\0';
+	}
+	if (*zcache_comp_name == '\0')
+		strlcpy(zcache_comp_name, ZCACHE_COMP_NAME_DEFAULT,
+			sizeof(zcache_comp_name));
+	if (!crypto_has_comp(zcache_comp_name, 0, 0)) {
+		pr_err("zcache: no %s compressor\n", zcache_comp_name);
+		return -ENODEV;
+	}
+	pr_info("zcache: using %s compressor\n", zcache_comp_name);
+	return 0;
+}
+
 
 static int zcache_cpu_notifier(struct notifier_block *nb,
 				unsigned long action, void *pcpu)
 {
 	int cpu = (long)pcpu;
 	struct zcache_preload *kp;
+	struct crypto_comp *tfm;
 
 	switch (action) {
 	case CPU_UP_PREPARE:
 		per_cpu(zcache_dstmem, cpu) = (void *)__get_free_pages(
 			GFP_KERNEL | __GFP_REPEAT,
-			LZO_DSTMEM_PAGE_ORDER),
-		per_cpu(zcache_workmem, cpu) =
-			kzalloc(LZO1X_MEM_COMPRESS,
-				GFP_KERNEL | __GFP_REPEAT);
+			ZCACHE_DSTMEM_ORDER);
+		tfm = crypto_alloc_comp(zcache_comp_name, 0, 0);
+		if (IS_ERR(tfm))
+			tfm = NULL;
+		per_cpu(zcache_comp_tfm, cpu) = tfm;
 		break;
 	case CPU_DEAD:
 	case CPU_UP_CANCELED:
 		free_pages((unsigned long)per_cpu(zcache_dstmem, cpu),
-				LZO_DSTMEM_PAGE_ORDER);
+				ZCACHE_DSTMEM_ORDER);
 		per_cpu(zcache_dstmem, cpu) = NULL;
-		kfree(per_cpu(zcache_workmem, cpu));
-		per_cpu(zcache_workmem, cpu) = NULL;
+		tfm = per_cpu(zcache_comp_tfm, cpu);
+		per_cpu(zcache_comp_tfm, cpu) = NULL;
+		if (tfm != NULL)
+			crypto_free_comp(tfm);
 		kp = &per_cpu(zcache_preloads, cpu);
 		while (kp->nr) {
 			kmem_cache_free(zcache_objnode_cache,
@@ -1067,6 +1258,61 @@ static struct notifier_block zcache_cpu_notifier_block = {
 };
 
 #ifdef CONFIG_SYSFS
+static int zcache_show_comp_name(char *buf)
+{
+	return sprintf(buf, "%s\n", zcache_comp_name);
+}
+
+/* one line per pool in use: id, then the counters in header order */
+static int zcache_show_pool_stats(char *buf)
+{
+	struct zcache_pool_stats *st;
+	char *p = buf;
+	int i;
+
+	p += sprintf(p, "pool puts failed_puts hits misses flushes "
+			"evictions\n");
+	for (i = 0; i < MAX_POOLS_PER_CLIENT; i++) {
+		if (zcache_client.tmem_pools[i] == NULL)
+			continue;
+		st = &zcache_client.pool_stats[i];
+		p += sprintf(p, "%d %lu %lu %lu %lu %lu %lu\n", i, st->puts,
+			st->failed_puts, st->hits, st->misses, st->flushes,
+			st->evictions);
+	}
+	return p - buf;
+}
+
+/* one line per pool in use: id, then ZCACHE_LAT_BUCKETS counts */
+static int zcache_show_pool_latency(char *buf, bool get)
+{
+	unsigned long *hist;
+	char *p = buf;
+	int i, j;
+
+	for (i = 0; i < MAX_POOLS_PER_CLIENT; i++) {
+		if (zcache_client.tmem_pools[i] == NULL)
+			continue;
+		hist = get ? zcache_client.pool_stats[i].get_lat :
+				zcache_client.pool_stats[i].put_lat;
+		p += sprintf(p, "%d", i);
+		for (j = 0; j < ZCACHE_LAT_BUCKETS; j++)
+			p += sprintf(p, " %lu", hist[j]);
+		p += sprintf(p, "\n");
+	}
+	return p - buf;
+}
+
+static int zcache_show_pool_put_latency(char *buf)
+{
+	return zcache_show_pool_latency(buf, false);
+}
+
+static int zcache_show_pool_get_latency(char *buf)
+{
+	return zcache_show_pool_latency(buf, true);
+}
+
 #define ZCACHE_SYSFS_RO(_name) \
 	static ssize_t zcache_##_name##_show(struct kobject *kobj, \
 				struct kobj_attribute *attr, char *buf) \
@@ -1130,6 +1376,11 @@ ZCACHE_SYSFS_RO_CUSTOM(zbud_unbuddied_list_counts,
 			zbud_show_unbuddied_list_counts);
 ZCACHE_SYSFS_RO_CUSTOM(zbud_cumul_chunk_counts,
 			zbud_show_cumul_chunk_counts);
+ZCACHE_SYSFS_RO(zbud_compactions);
+ZCACHE_SYSFS_RO_CUSTOM(comp_name, zcache_show_comp_name);
+ZCACHE_SYSFS_RO_CUSTOM(pool_stats, zcache_show_pool_stats);
+ZCACHE_SYSFS_RO_CUSTOM(pool_put_latency, zcache_show_pool_put_latency);
+ZCACHE_SYSFS_RO_CUSTOM(pool_get_latency, zcache_show_pool_get_latency);
 
 static struct attribute *zcache_attrs[] = {
 	&zcache_curr_obj_count_attr.attr,
@@ -1160,6 +1411,11 @@ static struct attribute *zcache_attrs[] = {
 	&zcache_aborted_shrink_attr.attr,
 	&zcache_zbud_unbuddied_list_counts_attr.attr,
 	&zcache_zbud_cumul_chunk_counts_attr.attr,
+	&zcache_zbud_compactions_attr.attr,
+	&zcache_comp_name_attr.attr,
+	&zcache_pool_stats_attr.attr,
+	&zcache_pool_put_latency_attr.attr,
+	&zcache_pool_get_latency_attr.attr,
 	NULL,
 };
 
@@ -1213,21 +1469,28 @@ static int zcache_put_page(int pool_id, struct tmem_oid *oidp,
 				uint32_t index, struct page *page)
 {
 	struct tmem_pool *pool;
+	struct zcache_pool_stats *st;
+	ktime_t start;
 	int ret = -1;
 
 	BUG_ON(!irqs_disabled());
 	pool = zcache_get_pool_by_id(pool_id);
 	if (unlikely(pool == NULL))
 		goto out;
+	st = &zcache_client.pool_stats[pool_id];
 	if (!zcache_freeze && zcache_do_preload(pool) == 0) {
 		/* preload does preempt_disable on success */
+		start = ktime_get();
 		ret = tmem_put(pool, oidp, index, page);
+		zcache_lat_account(st->put_lat, start);
 		if (ret < 0) {
+			st->failed_puts++;
 			if (is_ephemeral(pool))
 				zcache_failed_eph_puts++;
 			else
 				zcache_failed_pers_puts++;
-		}
+		} else
+			st->puts++;
 		zcache_put_pool(pool);
 		preempt_enable_no_resched();
 	} else {
@@ -1245,14 +1508,25 @@ static int zcache_get_page(int pool_id, struct tmem_oid *oidp,
 				uint32_t index, struct page *page)
 {
 	struct tmem_pool *pool;
+	struct zcache_pool_stats *st;
+	ktime_t start;
 	int ret = -1;
 	unsigned long flags;
 
 	local_irq_save(flags);
 	pool = zcache_get_pool_by_id(pool_id);
 	if (likely(pool != NULL)) {
-		if (atomic_read(&pool->obj_count) > 0)
+		st = &zcache_client.pool_stats[pool_id];
+		if (atomic_read(&pool->obj_count) > 0) {
+			start = ktime_get();
 			ret = tmem_get(pool, oidp, index, page);
+			if (ret >= 0)
+				zcache_lat_account(st->get_lat, start);
+		}
+		if (ret >= 0)
+			st->hits++;
+		else
+			st->misses++;
 		zcache_put_pool(pool);
 	}
 	local_irq_restore(flags);
@@ -1271,6 +1545,8 @@ static int zcache_flush_page(int pool_id, struct tmem_oid *oidp, uint32_t index)
 	if (likely(pool != NULL)) {
 		if (atomic_read(&pool->obj_count) > 0)
 			ret = tmem_flush_page(pool, oidp, index);
+		if (ret >= 0)
+			zcache_client.pool_stats[pool_id].flushes++;
 		zcache_put_pool(pool);
 	}
 	if (ret >= 0)
@@ -1316,6 +1592,8 @@ static int zcache_destroy_pool(int pool_id)
 	local_bh_disable();
 	ret = tmem_destroy_pool(pool);
 	local_bh_enable();
+	/* tmem hands objects back from rcu callbacks */
+	rcu_barrier();
 	kfree(pool);
 	pr_info("zcache: destroyed pool id=%d\n", pool_id);
 out:
@@ -1343,6 +1621,8 @@ static int zcache_new_pool(uint32_t flags)
 		goto out;
 	}
 	atomic_set(&pool->refcount, 0);
+	memset(&zcache_client.pool_stats[poolid], 0,
+		sizeof(zcache_client.pool_stats[poolid]));
 	pool->client = &zcache_client;
 	pool->pool_id = poolid;
 	tmem_new_pool(pool, flags);
@@ -1560,9 +1840,12 @@ struct frontswap_ops zcache_frontswap_register_ops(void)
 
 static int zcache_enabled;
 
+/* "zcache" enables with the default compressor, "zcache=<alg>" selects one */
 static int __init enable_zcache(char *s)
 {
 	zcache_enabled = 1;
+	if (*s == '=' && *++s != '\0')
+		strlcpy(zcache_comp_name, s, sizeof(zcache_comp_name));
 	return 1;
 }
 __setup("zcache", enable_zcache);
@@ -1604,6 +1887,11 @@ static int __init zcache_init(void)
 	if (zcache_enabled) {
 		unsigned int cpu;
 
+		ret = zcache_comp_init();
+		if (ret) {
+			zcache_enabled = 0;
+			goto out;
+		}
 		tmem_register_hostops(&zcache_hostops);
 		tmem_register_pamops(&zcache_pamops);
 		ret = register_cpu_notifier(&zcache_cpu_notifier_block);
@@ -0,0 +1,152 @@
+/*
+ * Compressed RAM block device - same page deduplication
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#include <linux/jhash.h>
+#include <linux/rbtree.h>
+#include <linux/slab.h>
+
+#include "zram_drv.h"
+
+static struct kmem_cache *zram_entry_cache;
+
+int __init zram_dedup_init(void)
+{
+	zram_entry_cache = kmem_cache_create("zram_entry",
+				sizeof(struct zram_entry), 0, 0, NULL);
+	if (!zram_entry_cache)
+		return -ENOMEM;
+
+	return 0;
+}
+
+void zram_dedup_exit(void)
+{
+	kmem_cache_destroy(zram_entry_cache);
+}
+
+u32 zram_dedup_checksum(const unsigned char *mem)
+{
+	return jhash2((const u32 *)mem, PAGE_SIZE / sizeof(u32), 0);
+}
+
+static void zram_dedup_insert(struct zram *zram, struct zram_entry *new)
+{
+	struct rb_node **rb_node, *parent = NULL;
+	struct zram_entry *entry;
+
+	spin_lock(&zram->dedup_lock);
+
+	rb_node = &zram->dedup_root.rb_node;
+	while (*rb_node) {
+		parent = *rb_node;
+		entry = rb_entry(parent, struct zram_entry, rb_node);
+		if (new->checksum < entry->checksum)
+			rb_node = &parent->rb_left;
+		else
+			rb_node = &parent->rb_right;
+	}
+
+	rb_link_node(&new->rb_node, parent, rb_node);
+	rb_insert_color(&new->rb_node, &zram->dedup_root);
+
+	spin_unlock(&zram->dedup_lock);
+}
+
+/*
+ * Wrap a freshly written object in an entry and make it visible to
+ * zram_dedup_get(). The caller owns the only reference.
+ */
+struct zram_entry *zram_entry_alloc(struct zram *zram,
+		unsigned long handle, unsigned int len, u32 checksum,
+		gfp_t flags)
+{
+	struct zram_entry *entry;
+
+	entry = kmem_cache_alloc(zram_entry_cache, flags);
+	if (!entry)
+		return NULL;
+
+	entry->handle = handle;
+	entry->len = len;
+	entry->checksum = checksum;
+	entry->refcount = 1;
+
+	zram_dedup_insert(zram, entry);
+
+	return entry;
+}
+
+/*
+ * Return the first entry whose page has the given checksum, or the one
+ * after @prev if that is given, with a reference taken, or NULL.
+ * Checksums may collide: the caller has to compare the contents, and
+ * move on to the next entry if they differ. Entries with the same
+ * checksum are next to each other in the tree, and @prev stays in it
+ * while the caller holds its reference.
+ */
+struct zram_entry *zram_dedup_get(struct zram *zram, u32 checksum,
+		struct zram_entry *prev)
+{
+	struct rb_node *rb_node;
+	struct zram_entry *entry, *found = NULL;
+
+	spin_lock(&zram->dedup_lock);
+
+	if (prev) {
+		rb_node = rb_next(&prev->rb_node);
+		if (rb_node) {
+			entry = rb_entry(rb_node, struct zram_entry, rb_node);
+			if (entry->checksum == checksum)
+				found = entry;
+		}
+		goto out;
+	}
+
+	rb_node = zram->dedup_root.rb_node;
+	while (rb_node) {
+		entry = rb_entry(rb_node, struct zram_entry, rb_node);
+		if (checksum == entry->checksum)
+			found = entry;
+
+		if (checksum <= entry->checksum)
+			rb_node = rb_node->rb_left;
+		else
+			rb_node = rb_node->rb_right;
+	}
+
+out:
+	if (found)
+		found->refcount++;
+	spin_unlock(&zram->dedup_lock);
+
+	return found;
+}
+
+/*
+ * Drop a reference. Returns 1 if that was the last one, in which case
+ * the entry and its object have been freed.
+ */
+int zram_entry_put(struct zram *zram, struct zram_entry *entry)
+{
+	int last;
+
+	spin_lock(&zram->dedup_lock);
+	last = !--entry->refcount;
+	if (last)
+		rb_erase(&entry->rb_node, &zram->dedup_root);
+	spin_unlock(&zram->dedup_lock);
+
+	if (last) {
+		zs_free(zram->mem_pool, entry->handle);
+		kmem_cache_free(zram_entry_cache, entry);
+	}
+
+	return last;
+}
@@ -23,14 +23,18 @@
 #include <linux/kernel.h>
 #include <linux/bio.h>
 #include <linux/bitops.h>
+#include <linux/bit_spinlock.h>
 #include <linux/blkdev.h>
 #include <linux/buffer_head.h>
+#include <linux/completion.h>
 #include <linux/device.h>
+#include <linux/fs.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
+#include <linux/ktime.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
 #include <linux/string.h>
+#include <linux/time.h>
 #include <linux/vmalloc.h>
 
 #include "zram_drv.h"
@@ -42,14 +46,14 @@ struct zram *devices;
 /* Module params (documentation at end) */
 unsigned int num_devices;
 
-static void zram_stat_inc(u32 *v)
+static void zram_stat_inc(atomic_t *v)
 {
-	*v = *v + 1;
+	atomic_inc(v);
 }
 
-static void zram_stat_dec(u32 *v)
+static void zram_stat_dec(atomic_t *v)
 {
-	*v = *v - 1;
+	atomic_dec(v);
 }
 
 static void zram_stat64_add(struct zram *zram, u64 *v, u64 inc)
@@ -89,6 +93,158 @@ static void zram_clear_flag(struct zram *zram, u32 index,
 	zram->table[index].flags &= ~BIT(flag);
 }
 
+static void zram_touch(struct zram *zram, u32 index)
+{
+	zram->table[index].ac_time = get_seconds();
+}
+
+/*
+ * Table entries are only ever modified with the slot lock held. Other
+ * flags share the word with the lock bit but are only changed by the
+ * lock holder, so the plain read-modify-write above is safe.
+ */
+static void zram_slot_lock(struct zram *zram, u32 index)
+{
+	bit_spin_lock(ZRAM_ACCESS, &zram->table[index].flags);
+}
+
+static void zram_slot_unlock(struct zram *zram, u32 index)
+{
+	bit_spin_unlock(ZRAM_ACCESS, &zram->table[index].flags);
+}
+
+/*
+ * Grab the compression stream of the local CPU. We may sleep while
+ * holding it (allocating memory for the compressed object), so it is
+ * protected by a mutex rather than by disabling preemption; contention
+ * on it is limited to writers that got migrated in the meantime.
+ */
+static struct zram_comp_strm *zram_comp_strm_get(struct zram *zram)
+{
+	struct zram_comp_strm *zstrm;
+
+	zstrm = per_cpu_ptr(zram->comp_strm, raw_smp_processor_id());
+	mutex_lock(&zstrm->lock);
+
+	return zstrm;
+}
+
+static void zram_comp_strm_put(struct zram_comp_strm *zstrm)
+{
+	mutex_unlock(&zstrm->lock);
+}
+
+static void zram_comp_strm_destroy(struct zram *zram)
+{
+	int cpu;
+
+	if (!zram->comp_strm)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct zram_comp_strm *zstrm;
+
+		zstrm = per_cpu_ptr(zram->comp_strm, cpu);
+		if (zstrm->tfm)
+			crypto_free_comp(zstrm->tfm);
+		free_pages((unsigned long)zstrm->buffer, 1);
+	}
+
+	free_percpu(zram->comp_strm);
+	zram->comp_strm = NULL;
+}
+
+static int zram_comp_strm_create(struct zram *zram)
+{
+	int cpu;
+
+	zram->comp_strm = alloc_percpu(struct zram_comp_strm);
+	if (!zram->comp_strm)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct zram_comp_strm *zstrm;
+
+		zstrm = per_cpu_ptr(zram->comp_strm, cpu);
+		mutex_init(&zstrm->lock);
+
+		zstrm->tfm = crypto_alloc_comp(zram->compressor, 0, 0);
+		if (IS_ERR(zstrm->tfm)) {
+			int ret = PTR_ERR(zstrm->tfm);
+
+			zstrm->tfm = NULL;
+			zram_comp_strm_destroy(zram);
+			return ret;
+		}
+
+		zstrm->buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
+		if (!zstrm->buffer) {
+			zram_comp_strm_destroy(zram);
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+void zram_comp_strm_stats(struct zram *zram, u64 *num_compr,
+		u64 *compr_time, u64 *num_decompr, u64 *decompr_time)
+{
+	int cpu;
+
+	*num_compr = *compr_time = *num_decompr = *decompr_time = 0;
+
+	for_each_possible_cpu(cpu) {
+		struct zram_comp_strm *zstrm;
+
+		zstrm = per_cpu_ptr(zram->comp_strm, cpu);
+		mutex_lock(&zstrm->lock);
+		*num_compr += zstrm->num_compr;
+		*compr_time += zstrm->compr_time;
+		*num_decompr += zstrm->num_decompr;
+		*decompr_time += zstrm->decompr_time;
+		mutex_unlock(&zstrm->lock);
+	}
+}
+
+/*
+ * Compress one page into zstrm->buffer. On success *clen holds the
+ * compressed length.
+ */
+static int zram_compress_page(struct zram_comp_strm *zstrm,
+			const unsigned char *src, unsigned int *clen)
+{
+	int ret;
+	ktime_t start = ktime_get();
+
+	*clen = 2 * PAGE_SIZE;
+	ret = crypto_comp_compress(zstrm->tfm, src, PAGE_SIZE,
+				zstrm->buffer, clen);
+
+	zstrm->compr_time += ktime_to_ns(ktime_sub(ktime_get(), start));
+	zstrm->num_compr++;
+
+	return ret;
+}
+
+static int zram_decompress_page(struct zram_comp_strm *zstrm,
+			const unsigned char *src, unsigned int clen,
+			unsigned char *dst)
+{
+	int ret;
+	unsigned int dlen = PAGE_SIZE;
+	ktime_t start = ktime_get();
+
+	ret = crypto_comp_decompress(zstrm->tfm, src, clen, dst, &dlen);
+	if (!ret && dlen != PAGE_SIZE)
+		ret = -EIO;
+
+	zstrm->decompr_time += ktime_to_ns(ktime_sub(ktime_get(), start));
+	zstrm->num_decompr++;
+
+	return ret;
+}
+
 static int page_zero_filled(void *ptr)
 {
 	unsigned int pos;
@@ -133,15 +289,25 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
+/*
+ * Release the memory backing @index. Caller must hold the slot lock.
+ */
 static void zram_free_page(struct zram *zram, size_t index)
 {
 	u32 clen;
-	void *obj;
+	struct zram_entry *entry = zram->table[index].entry;
+
+	/* Makes a writeback of the old contents back off */
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
 
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
+	if (unlikely(zram_test_flag(zram, index, ZRAM_WB))) {
+		clear_bit(zram->table[index].block, zram->bitmap);
+		zram_clear_flag(zram, index, ZRAM_WB);
+		zram_stat_dec(&zram->stats.bd_count);
+		goto out;
+	}
 
-	if (unlikely(!page)) {
+	if (unlikely(!entry)) {
 		/*
 		 * No memory is allocated for zero filled pages.
 		 * Simply clear zero page flag.
@@ -155,26 +321,28 @@ static void zram_free_page(struct zram *zram, size_t index)
 
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
 		clen = PAGE_SIZE;
-		__free_page(page);
+		__free_page(zram->table[index].page);
 		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
+		clear_bit(index, zram->huge_bitmap);
 		zram_stat_dec(&zram->stats.pages_expand);
+		zram_stat64_sub(zram, &zram->stats.compr_size, clen);
 		goto out;
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
-
-	xv_free(zram->mem_pool, page, offset);
+	clen = entry->len;
 	if (clen <= PAGE_SIZE / 2)
 		zram_stat_dec(&zram->stats.good_compress);
 
+	/* Other pages may still share this object */
+	if (zram_entry_put(zram, entry))
+		zram_stat64_sub(zram, &zram->stats.compr_size, clen);
+	else
+		zram_stat64_sub(zram, &zram->stats.dedup_saved, clen);
+
 out:
-	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
 	zram_stat_dec(&zram->stats.pages_stored);
 
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
+	zram->table[index].entry = NULL;
 }
 
 static void handle_zero_page(struct page *page)
@@ -194,8 +362,7 @@ static void handle_uncompressed_page(struct zram *zram,
 	unsigned char *user_mem, *cmem;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-			zram->table[index].offset;
+	cmem = kmap_atomic(zram->table[index].page, KM_USER1);
 
 	memcpy(user_mem, cmem, PAGE_SIZE);
 	kunmap_atomic(user_mem, KM_USER0);
@@ -204,33 +371,96 @@ static void handle_uncompressed_page(struct zram *zram,
 	flush_dcache_page(page);
 }
 
+/*
+ * Pages on the backing device are read with one child bio each. The
+ * parent bio completes when the last child (or zram_read() itself,
+ * which holds a reference while it submits them) is done.
+ */
+struct zram_bd_read {
+	struct bio *parent;
+	atomic_t pending;
+	int error;
+};
+
+static void zram_bd_read_put(struct zram_bd_read *bd_read, int error)
+{
+	if (error)
+		bd_read->error = error;
+
+	if (atomic_dec_and_test(&bd_read->pending)) {
+		bio_endio(bd_read->parent, bd_read->error);
+		kfree(bd_read);
+	}
+}
+
+static void zram_bd_read_end_io(struct bio *bio, int error)
+{
+	struct zram_bd_read *bd_read = bio->bi_private;
+
+	bio_put(bio);
+	zram_bd_read_put(bd_read, error);
+}
+
+static int zram_bd_read(struct zram *zram, struct zram_bd_read *bd_read,
+			struct page *page, unsigned long block)
+{
+	struct bio *bio;
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_bdev = zram->bdev;
+	bio->bi_sector = block << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_end_io = zram_bd_read_end_io;
+	bio->bi_private = bd_read;
+	if (!bio_add_page(bio, page, PAGE_SIZE, 0)) {
+		bio_put(bio);
+		return -EIO;
+	}
+
+	atomic_inc(&bd_read->pending);
+	submit_bio(READ, bio);
+	zram_stat64_inc(zram, &zram->stats.bd_reads);
+
+	return 0;
+}
+
 static void zram_read(struct zram *zram, struct bio *bio)
 {
 
 	int i;
 	u32 index;
 	struct bio_vec *bvec;
+	struct zram_comp_strm *zstrm;
+	struct zram_bd_read *bd_read = NULL;
 
 	zram_stat64_inc(zram, &zram->stats.num_reads);
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
+	/* Taken before any slot lock: we cannot sleep under those */
+	zstrm = zram_comp_strm_get(zram);
+
 	bio_for_each_segment(bvec, bio, i) {
 		int ret;
-		size_t clen;
 		struct page *page;
-		struct zobj_header *zheader;
+		struct zram_entry *entry;
 		unsigned char *user_mem, *cmem;
 
 		page = bvec->bv_page;
 
+		zram_slot_lock(zram, index);
+
 		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
+			zram_slot_unlock(zram, index);
 			handle_zero_page(page);
 			index++;
 			continue;
 		}
 
 		/* Requested page is not present in compressed area */
-		if (unlikely(!zram->table[index].page)) {
+		if (unlikely(!zram->table[index].entry)) {
+			zram_slot_unlock(zram, index);
 			pr_debug("Read before write: sector=%lu, size=%u",
 				(ulong)(bio->bi_sector), bio->bi_size);
 			handle_zero_page(page);
@@ -238,29 +468,62 @@ static void zram_read(struct zram *zram, struct bio *bio)
 			continue;
 		}
 
+		zram_touch(zram, index);
+
+		if (unlikely(zram_test_flag(zram, index, ZRAM_WB))) {
+			unsigned long block = zram->table[index].block;
+
+			/*
+			 * The block cannot be reused before the read is
+			 * done: the caller does not free or overwrite a
+			 * sector it is reading.
+			 */
+			zram_slot_unlock(zram, index);
+
+			if (!bd_read) {
+				bd_read = kmalloc(sizeof(*bd_read), GFP_NOIO);
+				if (!bd_read) {
+					zram_stat64_inc(zram,
+						&zram->stats.failed_reads);
+					goto out;
+				}
+				bd_read->parent = bio;
+				bd_read->error = 0;
+				atomic_set(&bd_read->pending, 1);
+			}
+
+			ret = zram_bd_read(zram, bd_read, page, block);
+			if (unlikely(ret)) {
+				pr_err("Backing device read failed! err=%d, "
+					"page=%u\n", ret, index);
+				zram_stat64_inc(zram,
+					&zram->stats.failed_reads);
+				goto out;
+			}
+			index++;
+			continue;
+		}
+
 		/* Page is stored uncompressed since it's incompressible */
 		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
 			handle_uncompressed_page(zram, page, index);
+			zram_slot_unlock(zram, index);
 			index++;
 			continue;
 		}
 
 		user_mem = kmap_atomic(page, KM_USER0);
-		clen = PAGE_SIZE;
-
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+		entry = zram->table[index].entry;
+		cmem = zs_map_object(zram->mem_pool, entry->handle);
 
-		ret = lzo1x_decompress_safe(
-			cmem + sizeof(*zheader),
-			xv_get_object_size(cmem) - sizeof(*zheader),
-			user_mem, &clen);
+		ret = zram_decompress_page(zstrm, cmem, entry->len, user_mem);
 
+		zs_unmap_object(zram->mem_pool, entry->handle);
 		kunmap_atomic(user_mem, KM_USER0);
-		kunmap_atomic(cmem, KM_USER1);
+		zram_slot_unlock(zram, index);
 
 		/* Should NEVER happen. Return bio error if it does. */
-		if (unlikely(ret != LZO_E_OK)) {
+		if (unlikely(ret)) {
 			pr_err("Decompression failed! err=%d, page=%u\n",
 				ret, index);
 			zram_stat64_inc(zram, &zram->stats.failed_reads);
@@ -271,12 +534,86 @@ static void zram_read(struct zram *zram, struct bio *bio)
 		index++;
 	}
 
+	zram_comp_strm_put(zstrm);
 	set_bit(BIO_UPTODATE, &bio->bi_flags);
-	bio_endio(bio, 0);
+	if (bd_read)
+		zram_bd_read_put(bd_read, 0);
+	else
+		bio_endio(bio, 0);
 	return;
 
 out:
-	bio_io_error(bio);
+	zram_comp_strm_put(zstrm);
+	if (bd_read)
+		zram_bd_read_put(bd_read, -EIO);
+	else
+		bio_io_error(bio);
+}
+
+/*
+ * Install a new object for @index, dropping whatever the slot held
+ * before. This is the only place (besides zram_slot_free_notify())
+ * that frees objects while the device is live, so the old object
+ * cannot be freed twice by racing writers.
+ */
+static void zram_set_page(struct zram *zram, u32 index,
+			struct zram_entry *entry, struct page *page,
+			unsigned long flags)
+{
+	zram_slot_lock(zram, index);
+
+	if (zram->table[index].entry ||
+			zram_test_flag(zram, index, ZRAM_ZERO))
+		zram_free_page(zram, index);
+
+	if (page) {
+		zram->table[index].page = page;
+		set_bit(index, zram->huge_bitmap);
+	} else {
+		zram->table[index].entry = entry;
+	}
+	zram->table[index].flags |= flags;
+	zram_touch(zram, index);
+
+	zram_slot_unlock(zram, index);
+}
+
+/*
+ * Look for a stored page with the same contents as @mem. Each candidate
+ * with a matching checksum is decompressed into the stream buffer,
+ * which compression would overwrite next anyway, and compared.
+ */
+static struct zram_entry *zram_dedup_find(struct zram *zram,
+			struct zram_comp_strm *zstrm,
+			const unsigned char *mem, u32 checksum)
+{
+	int ret;
+	u16 len;
+	unsigned char *cmem;
+	struct zram_entry *entry = NULL, *prev;
+
+	for (;;) {
+		prev = entry;
+		entry = zram_dedup_get(zram, checksum, prev);
+
+		/* Checksum collision with @prev */
+		if (prev) {
+			len = prev->len;
+			if (zram_entry_put(zram, prev))
+				zram_stat64_sub(zram, &zram->stats.compr_size,
+						len);
+		}
+		if (!entry)
+			return NULL;
+
+		cmem = zs_map_object(zram->mem_pool, entry->handle);
+		ret = zram_decompress_page(zstrm, cmem, entry->len,
+					zstrm->buffer);
+		zs_unmap_object(zram->mem_pool, entry->handle);
+
+		if (!ret && !memcmp(zstrm->buffer, mem, PAGE_SIZE))
+			return entry;
+	}
 }
 
 static void zram_write(struct zram *zram, struct bio *bio)
@@ -290,42 +627,58 @@ static void zram_write(struct zram *zram, struct bio *bio)
 
 	bio_for_each_segment(bvec, bio, i) {
 		int ret;
-		u32 offset;
-		size_t clen;
-		struct zobj_header *zheader;
-		struct page *page, *page_store;
+		u32 checksum;
+		unsigned int clen;
+		unsigned long handle;
+		unsigned long flags = 0;
+		struct zram_entry *entry = NULL;
+		struct zram_comp_strm *zstrm;
+		struct page *page, *page_store = NULL;
 		unsigned char *user_mem, *cmem, *src;
 
 		page = bvec->bv_page;
-		src = zram->compress_buffer;
 
-		/*
-		 * System overwrites unused sectors. Free memory associated
-		 * with this sector now.
-		 */
-		if (zram->table[index].page ||
-				zram_test_flag(zram, index, ZRAM_ZERO))
-			zram_free_page(zram, index);
-
-		mutex_lock(&zram->lock);
+		/* Taken before kmap_atomic(): getting the stream may sleep */
+		zstrm = zram_comp_strm_get(zram);
 
 		user_mem = kmap_atomic(page, KM_USER0);
 		if (page_zero_filled(user_mem)) {
 			kunmap_atomic(user_mem, KM_USER0);
-			mutex_unlock(&zram->lock);
+			zram_comp_strm_put(zstrm);
+			zram_set_page(zram, index, NULL, NULL, BIT(ZRAM_ZERO));
 			zram_stat_inc(&zram->stats.pages_zero);
-			zram_set_flag(zram, index, ZRAM_ZERO);
 			index++;
 			continue;
 		}
 
-		ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-					zram->compress_workmem);
+		checksum = zram_dedup_checksum(user_mem);
+
+		entry = zram_dedup_find(zram, zstrm, user_mem, checksum);
+		if (entry) {
+			kunmap_atomic(user_mem, KM_USER0);
+			zram_comp_strm_put(zstrm);
+
+			/* The slot may be overwritten as soon as it is set */
+			clen = entry->len;
+			zram_set_page(zram, index, entry, NULL, 0);
+
+			zram_stat64_inc(zram, &zram->stats.dedup_hits);
+			zram_stat64_add(zram, &zram->stats.dedup_saved, clen);
+			zram_stat_inc(&zram->stats.pages_stored);
+			if (clen <= PAGE_SIZE / 2)
+				zram_stat_inc(&zram->stats.good_compress);
+			index++;
+			continue;
+		}
+
+		src = zstrm->buffer;
+
+		ret = zram_compress_page(zstrm, user_mem, &clen);
 
 		kunmap_atomic(user_mem, KM_USER0);
 
-		if (unlikely(ret != LZO_E_OK)) {
-			mutex_unlock(&zram->lock);
+		if (unlikely(ret)) {
+			zram_comp_strm_put(zstrm);
 			pr_err("Compression failed! err=%d\n", ret);
 			zram_stat64_inc(zram, &zram->stats.failed_writes);
 			goto out;
@@ -340,7 +693,7 @@ static void zram_write(struct zram *zram, struct bio *bio)
 			clen = PAGE_SIZE;
 			page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
 			if (unlikely(!page_store)) {
-				mutex_unlock(&zram->lock);
+				zram_comp_strm_put(zstrm);
 				pr_info("Error allocating memory for "
 					"incompressible page: %u\n", index);
 				zram_stat64_inc(zram,
@@ -348,52 +701,60 @@ static void zram_write(struct zram *zram, struct bio *bio)
 				goto out;
 			}
 
-			offset = 0;
-			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-			zram_stat_inc(&zram->stats.pages_expand);
-			zram->table[index].page = page_store;
-			src = kmap_atomic(page, KM_USER0);
-			goto memstore;
-		}
+			flags = BIT(ZRAM_UNCOMPRESSED);
 
-		if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-				&zram->table[index].page, &offset,
-				GFP_NOIO | __GFP_HIGHMEM)) {
-			mutex_unlock(&zram->lock);
-			pr_info("Error allocating memory for compressed "
-				"page: %u, size=%zu\n", index, clen);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
-		}
-
-memstore:
-		zram->table[index].offset = offset;
+			src = kmap_atomic(page, KM_USER0);
+			cmem = kmap_atomic(page_store, KM_USER1);
+			memcpy(cmem, src, clen);
+			kunmap_atomic(cmem, KM_USER1);
+			kunmap_atomic(src, KM_USER0);
+		} else {
+			handle = zs_malloc(zram->mem_pool, clen,
+					GFP_NOIO | __GFP_HIGHMEM);
+			if (unlikely(!handle)) {
+				zram_comp_strm_put(zstrm);
+				pr_info("Error allocating memory for "
+					"compressed page: %u, size=%u\n",
+					index, clen);
+				zram_stat64_inc(zram,
+					&zram->stats.failed_writes);
+				goto out;
+			}
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+			cmem = zs_map_object(zram->mem_pool, handle);
+			memcpy(cmem, src, clen);
+			zs_unmap_object(zram->mem_pool, handle);
 
-#if 0
-		/* Back-reference needed for memory defragmentation */
-		if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-			zheader = (struct zobj_header *)cmem;
-			zheader->table_idx = index;
-			cmem += sizeof(*zheader);
+			entry = zram_entry_alloc(zram, handle, clen, checksum,
+					GFP_NOIO);
+			if (unlikely(!entry)) {
+				zram_comp_strm_put(zstrm);
+				zs_free(zram->mem_pool, handle);
+				zram_stat64_inc(zram,
+					&zram->stats.failed_writes);
+				goto out;
+			}
 		}
-#endif
 
-		memcpy(cmem, src, clen);
+		zram_comp_strm_put(zstrm);
 
-		kunmap_atomic(cmem, KM_USER1);
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			kunmap_atomic(src, KM_USER0);
+		/*
+		 * System overwrites unused sectors. Free memory associated
+		 * with this sector now.
+		 */
+		zram_set_page(zram, index, entry, page_store, flags);
 
 		/* Update stats */
 		zram_stat64_add(zram, &zram->stats.compr_size, clen);
 		zram_stat_inc(&zram->stats.pages_stored);
-		if (clen <= PAGE_SIZE / 2)
+		if (unlikely(flags & BIT(ZRAM_UNCOMPRESSED))) {
+			zram_stat_inc(&zram->stats.pages_expand);
+			/* Move it out of RAM if we have somewhere to put it */
+			if (zram->bdev)
+				schedule_work(&zram->wb_work);
+		} else if (clen <= PAGE_SIZE / 2)
 			zram_stat_inc(&zram->stats.good_compress);
 
-		mutex_unlock(&zram->lock);
 		index++;
 	}
 
@@ -405,6 +766,214 @@ out:
 	bio_io_error(bio);
 }
 
+/*
+ * Hand out a free block of the backing device. Block 0 is never used,
+ * so that a table entry of a written back page is never NULL.
+ */
+static unsigned long zram_bd_alloc_block(struct zram *zram)
+{
+	unsigned long block;
+
+	do {
+		block = find_next_zero_bit(zram->bitmap, zram->nr_bd_pages, 1);
+		if (block >= zram->nr_bd_pages)
+			return 0;
+	} while (test_and_set_bit(block, zram->bitmap));
+
+	return block;
+}
+
+static void zram_bd_write_end_io(struct bio *bio, int error)
+{
+	complete(bio->bi_private);
+}
+
+static int zram_bd_write(struct zram *zram, struct page *page,
+			unsigned long block)
+{
+	int ret;
+	struct bio *bio;
+	DECLARE_COMPLETION_ONSTACK(done);
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_bdev = zram->bdev;
+	bio->bi_sector = block << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_end_io = zram_bd_write_end_io;
+	bio->bi_private = &done;
+	if (!bio_add_page(bio, page, PAGE_SIZE, 0)) {
+		bio_put(bio);
+		return -EIO;
+	}
+
+	submit_bio(WRITE, bio);
+	wait_for_completion(&done);
+
+	ret = test_bit(BIO_UPTODATE, &bio->bi_flags) ? 0 : -EIO;
+	bio_put(bio);
+
+	return ret;
+}
+
+static int zram_wb_eligible(struct zram *zram, u32 index,
+			enum zram_wb_mode mode, u32 now)
+{
+	if (!zram->table[index].entry ||
+			zram_test_flag(zram, index, ZRAM_WB) ||
+			zram_test_flag(zram, index, ZRAM_UNDER_WB))
+		return 0;
+
+	if (mode == ZRAM_WB_HUGE)
+		return zram_test_flag(zram, index, ZRAM_UNCOMPRESSED);
+
+	return now - zram->table[index].ac_time >= zram->idle_age;
+}
+
+/*
+ * Copy the contents of @index into @page. Caller holds the slot lock.
+ */
+static int zram_copy_page(struct zram *zram, struct zram_comp_strm *zstrm,
+			u32 index, struct page *page)
+{
+	int ret = 0;
+	unsigned char *user_mem, *cmem;
+	struct zram_entry *entry;
+
+	if (zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
+		handle_uncompressed_page(zram, page, index);
+		return 0;
+	}
+
+	user_mem = kmap_atomic(page, KM_USER0);
+	entry = zram->table[index].entry;
+	cmem = zs_map_object(zram->mem_pool, entry->handle);
+	ret = zram_decompress_page(zstrm, cmem, entry->len, user_mem);
+	zs_unmap_object(zram->mem_pool, entry->handle);
+	kunmap_atomic(user_mem, KM_USER0);
+
+	return ret;
+}
+
+/*
+ * Write @index out if @mode selects it. The page is written out without
+ * the slot lock held; if the slot is freed or overwritten meanwhile,
+ * ZRAM_UNDER_WB is gone and the copy on disk is dropped again. Returns
+ * an error only if writeback should stop. Caller holds init_lock.
+ */
+static int zram_writeback_slot(struct zram *zram, u32 index,
+			enum zram_wb_mode mode, u32 now, struct page *page)
+{
+	int err;
+	unsigned long block;
+	struct zram_comp_strm *zstrm;
+
+	zstrm = zram_comp_strm_get(zram);
+	zram_slot_lock(zram, index);
+
+	if (!zram_wb_eligible(zram, index, mode, now)) {
+		zram_slot_unlock(zram, index);
+		zram_comp_strm_put(zstrm);
+		return 0;
+	}
+
+	err = zram_copy_page(zram, zstrm, index, page);
+	if (!err)
+		zram_set_flag(zram, index, ZRAM_UNDER_WB);
+
+	zram_slot_unlock(zram, index);
+	zram_comp_strm_put(zstrm);
+
+	if (err)
+		return 0;
+
+	block = zram_bd_alloc_block(zram);
+	if (block)
+		err = zram_bd_write(zram, page, block);
+	else
+		err = -ENOSPC;
+
+	zram_slot_lock(zram, index);
+	if (err || !zram_test_flag(zram, index, ZRAM_UNDER_WB)) {
+		zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+		zram_slot_unlock(zram, index);
+		if (block)
+			clear_bit(block, zram->bitmap);
+		return err;
+	}
+
+	zram_free_page(zram, index);
+	zram->table[index].block = block;
+	zram_set_flag(zram, index, ZRAM_WB);
+	zram_slot_unlock(zram, index);
+
+	zram_stat_inc(&zram->stats.pages_stored);
+	zram_stat_inc(&zram->stats.bd_count);
+	zram_stat64_inc(zram, &zram->stats.bd_writes);
+
+	return 0;
+}
+
+/*
+ * Move pages selected by @mode to the backing device. Huge pages are
+ * found through huge_bitmap; idle pages need a scan of the table.
+ * init_lock is only held for ZRAM_WB_BATCH slots at a time, so reset
+ * and sysfs do not wait for a whole pass; the device is checked again
+ * before every batch.
+ */
+int zram_writeback(struct zram *zram, enum zram_wb_mode mode)
+{
+	int ret = 0;
+	u32 now;
+	unsigned long index = 0, end;
+	struct page *page;
+
+	/* We may be writing back to make room for swap */
+	page = alloc_page(GFP_NOIO);
+	if (!page)
+		return -ENOMEM;
+
+	mutex_lock(&zram->wb_lock);
+	now = get_seconds();
+
+	while (!ret) {
+		mutex_lock(&zram->init_lock);
+		end = zram->disksize >> PAGE_SHIFT;
+		if (!zram->init_done || !zram->bdev || index >= end) {
+			mutex_unlock(&zram->init_lock);
+			break;
+		}
+
+		end = min(end, index + ZRAM_WB_BATCH);
+		for (; index < end && !ret; index++) {
+			if (mode == ZRAM_WB_HUGE) {
+				index = find_next_bit(zram->huge_bitmap, end,
+						index);
+				if (index >= end)
+					break;
+			}
+			ret = zram_writeback_slot(zram, index, mode, now,
+						page);
+		}
+		mutex_unlock(&zram->init_lock);
+
+		cond_resched();
+	}
+
+	mutex_unlock(&zram->wb_lock);
+	__free_page(page);
+
+	return ret;
+}
+
+static void zram_wb_work(struct work_struct *work)
+{
+	struct zram *zram = container_of(work, struct zram, wb_work);
+
+	zram_writeback(zram, ZRAM_WB_HUGE);
+}
+
 /*
  * Check if request is within bounds and page aligned.
  */
@@ -453,43 +1022,111 @@ static int zram_make_request(struct request_queue *queue, struct bio *bio)
 	return 0;
 }
 
+static void zram_put_backing_dev(struct zram *zram)
+{
+	if (!zram->bdev)
+		return;
+
+	blkdev_put(zram->bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	vfree(zram->bitmap);
+	kfree(zram->backing_dev);
+
+	zram->bdev = NULL;
+	zram->bitmap = NULL;
+	zram->backing_dev = NULL;
+	zram->nr_bd_pages = 0;
+}
+
+/*
+ * Use the block device at @path to hold pages written back from RAM.
+ * It is claimed exclusively until the zram device is reset. Caller
+ * holds init_lock and the device is not initialized yet.
+ */
+int zram_set_backing_dev(struct zram *zram, const char *path)
+{
+	int ret;
+	char *name;
+	unsigned long nr_pages, *bitmap;
+	struct block_device *bdev;
+
+	bdev = blkdev_get_by_path(path, FMODE_READ | FMODE_WRITE | FMODE_EXCL,
+				zram);
+	if (IS_ERR(bdev))
+		return PTR_ERR(bdev);
+
+	/* Block 0 is reserved, see zram_bd_alloc_block() */
+	nr_pages = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	if (nr_pages < 2) {
+		ret = -EINVAL;
+		goto put_bdev;
+	}
+
+	ret = -ENOMEM;
+	name = kstrdup(path, GFP_KERNEL);
+	if (!name)
+		goto put_bdev;
+
+	bitmap = vzalloc(BITS_TO_LONGS(nr_pages) * sizeof(long));
+	if (!bitmap) {
+		kfree(name);
+		goto put_bdev;
+	}
+
+	zram_put_backing_dev(zram);
+
+	zram->bdev = bdev;
+	zram->backing_dev = name;
+	zram->bitmap = bitmap;
+	zram->nr_bd_pages = nr_pages;
+
+	pr_info("%s: using %s as backing device (%lu pages)\n",
+		zram->disk->disk_name, name, nr_pages);
+	return 0;
+
+put_bdev:
+	blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	return ret;
+}
+
 void zram_reset_device(struct zram *zram)
 {
 	size_t index;
 
+	/* The work takes init_lock itself */
+	cancel_work_sync(&zram->wb_work);
+
 	mutex_lock(&zram->init_lock);
 	zram->init_done = 0;
 
 	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
-
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	zram_comp_strm_destroy(zram);
 
 	/* Free all pages that are still in this zram device */
 	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
-
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
+		if (!zram->table[index].entry)
+			continue;
 
-		if (!page)
+		/* The backing device goes away as a whole below */
+		if (unlikely(zram_test_flag(zram, index, ZRAM_WB)))
 			continue;
 
 		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
+			__free_page(zram->table[index].page);
 		else
-			xv_free(zram->mem_pool, page, offset);
+			zram_entry_put(zram, zram->table[index].entry);
 	}
 
 	vfree(zram->table);
 	zram->table = NULL;
+	vfree(zram->huge_bitmap);
+	zram->huge_bitmap = NULL;
 
-	xv_destroy_pool(zram->mem_pool);
+	if (zram->mem_pool)
+		zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
+	zram_put_backing_dev(zram);
+
 	/* Reset stats */
 	memset(&zram->stats, 0, sizeof(zram->stats));
 
@@ -511,17 +1148,10 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	ret = zram_comp_strm_create(zram);
+	if (ret) {
+		pr_err("Error allocating %s compression streams\n",
+			zram->compressor);
 		goto fail;
 	}
 
@@ -535,12 +1165,19 @@ int zram_init_device(struct zram *zram)
 		goto fail;
 	}
 
+	zram->huge_bitmap = vzalloc(BITS_TO_LONGS(num_pages) * sizeof(long));
+	if (!zram->huge_bitmap) {
+		pr_err("Error allocating zram huge page bitmap\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+
 	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
 
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = xv_create_pool();
+	zram->mem_pool = zs_create_pool(zram->disk->disk_name);
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
@@ -566,7 +1203,9 @@ void zram_slot_free_notify(struct block_device *bdev, unsigned long index)
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	zram_slot_lock(zram, index);
 	zram_free_page(zram, index);
+	zram_slot_unlock(zram, index);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -579,9 +1218,15 @@ static int create_device(struct zram *zram, int device_id)
 {
 	int ret = 0;
 
-	mutex_init(&zram->lock);
 	mutex_init(&zram->init_lock);
+	spin_lock_init(&zram->dedup_lock);
+	zram->dedup_root = RB_ROOT;
 	spin_lock_init(&zram->stat64_lock);
+	mutex_init(&zram->wb_lock);
+	INIT_WORK(&zram->wb_work, zram_wb_work);
+	zram->idle_age = default_idle_age;
+	strlcpy(zram->compressor, default_compressor,
+		sizeof(zram->compressor));
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -664,11 +1309,17 @@ static int __init zram_init(void)
 		goto out;
 	}
 
+	ret = zram_dedup_init();
+	if (ret) {
+		pr_warning("Unable to create entry cache\n");
+		goto out;
+	}
+
 	zram_major = register_blkdev(0, "zram");
 	if (zram_major <= 0) {
 		pr_warning("Unable to get major number\n");
 		ret = -EBUSY;
-		goto out;
+		goto dedup_exit;
 	}
 
 	if (!num_devices) {
@@ -698,6 +1349,8 @@ free_devices:
 	kfree(devices);
 unregister:
 	unregister_blkdev(zram_major, "zram");
+dedup_exit:
+	zram_dedup_exit();
 out:
 	return ret;
 }
@@ -713,9 +1366,12 @@ static void __exit zram_exit(void)
 		destroy_device(zram);
 		if (zram->init_done)
 			zram_reset_device(zram);
+		else
+			zram_put_backing_dev(zram);
 	}
 
 	unregister_blkdev(zram_major, "zram");
+	zram_dedup_exit();
 
 	kfree(devices);
 	pr_debug("Cleanup done!\n");
@@ -17,8 +17,12 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/crypto.h>
+#include <linux/rbtree.h>
+#include <linux/workqueue.h>
 
-#include "xvmalloc.h"
+#include "zsmalloc.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -26,23 +30,23 @@
  */
 static const unsigned max_num_devices = 32;
 
-/*
- * Stored at beginning of each compressed object.
- *
- * It stores back-reference to table entry which points to this
- * object. This is required to support memory defragmentation.
- */
-struct zobj_header {
-#if 0
-	u32 table_idx;
-#endif
-};
-
 /*-- Configurable parameters */
 
 /* Default zram disk size: 25% of total RAM */
 static const unsigned default_disksize_perc_ram = 25;
 
+/* Default compressor, any crypto_comp algorithm can be selected */
+static const char default_compressor[] = "lzo";
+
+/*
+ * Pages not accessed for this many seconds are written out by an
+ * "idle" writeback to the backing device.
+ */
+static const unsigned default_idle_age = 60 * 60;
+
+/* Slots zram_writeback() looks at per hold of init_lock */
+#define ZRAM_WB_BATCH	1024
+
 /*
  * Pages that compress to size greater than this are stored
  * uncompressed in memory.
@@ -51,8 +55,8 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /*
  * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ *   ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE
+ * otherwise, zs_malloc() would always return failure.
  */
 
 /*-- End of configurable params */
@@ -71,19 +75,74 @@ enum zram_pageflags {
 	/* Page consists entirely of zeros */
 	ZRAM_ZERO,
 
+	/* Slot is locked; see zram_slot_lock() */
+	ZRAM_ACCESS,
+
+	/* Page is stored on the backing device */
+	ZRAM_WB,
+
+	/* Page is being written to the backing device */
+	ZRAM_UNDER_WB,
+
 	__NR_ZRAM_PAGEFLAGS,
 };
 
 /*-- Data structures */
 
-/* Allocated for each disk page */
+/*
+ * A compressed object. Disk pages with identical contents share one
+ * entry; it is freed along with its object when the last of them goes.
+ */
+struct zram_entry {
+	struct rb_node rb_node;	/* in zram->dedup_root, by checksum */
+	u32 checksum;		/* of the uncompressed page */
+	u16 len;		/* compressed size */
+	unsigned long refcount;	/* protected by zram->dedup_lock */
+	unsigned long handle;	/* zsmalloc handle */
+};
+
+/*
+ * Allocated for each disk page.
+ *
+ * The object pointer and flags are protected by the ZRAM_ACCESS bit
+ * lock in flags, so that I/O to different pages of a device never
+ * serializes.
+ */
 struct table {
-	struct page *page;
-	u16 offset;
-	u8 count;	/* object ref count (not yet used) */
-	u8 flags;
+	union {
+		struct zram_entry *entry;
+		struct page *page;	/* if ZRAM_UNCOMPRESSED */
+		unsigned long block;	/* if ZRAM_WB, never 0 */
+	};
+	unsigned long flags;
+	u32 ac_time;	/* last access, in seconds */
 } __attribute__((aligned(4)));
 
+/* What zram_writeback() writes out */
+enum zram_wb_mode {
+	ZRAM_WB_HUGE,	/* incompressible pages */
+	ZRAM_WB_IDLE,	/* pages idle for more than idle_age */
+};
+
+/*
+ * Per-cpu compression stream. Each CPU compresses into its own buffer
+ * using its own crypto_comp transform, so writers on different CPUs do
+ * not contend. The mutex is only taken by a writer that got migrated
+ * while (or before) using the stream of its original CPU.
+ *
+ * Timing stats are updated under the stream lock and summed over all
+ * CPUs on read.
+ */
+struct zram_comp_strm {
+	struct mutex lock;
+	struct crypto_comp *tfm;
+	void *buffer;	/* compressed output, 2 pages */
+	u64 num_compr;
+	u64 compr_time;		/* ns */
+	u64 num_decompr;
+	u64 decompr_time;	/* ns */
+};
+
 struct zram_stats {
 	u64 compr_size;		/* compressed size of pages stored */
 	u64 num_reads;		/* failed + successful */
@@ -92,20 +151,25 @@ struct zram_stats {
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
-	u32 pages_zero;		/* no. of zero filled pages */
-	u32 pages_stored;	/* no. of pages currently stored */
-	u32 good_compress;	/* % of pages with compression ratio<=50% */
-	u32 pages_expand;	/* % of incompressible pages */
+	u64 dedup_hits;		/* writes that matched a stored page */
+	u64 dedup_saved;	/* compressed bytes of duplicates not stored */
+	u64 bd_reads;		/* pages read from the backing device */
+	u64 bd_writes;		/* pages written to the backing device */
+	atomic_t pages_zero;	/* no. of zero filled pages */
+	atomic_t pages_stored;	/* no. of pages currently stored */
+	atomic_t good_compress;	/* % of pages with compression ratio<=50% */
+	atomic_t pages_expand;	/* % of incompressible pages */
+	atomic_t bd_count;	/* no. of pages on the backing device */
 };
 
 struct zram {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
+	struct zram_comp_strm __percpu *comp_strm;
+	char compressor[CRYPTO_MAX_ALG_NAME];
 	struct table *table;
+	spinlock_t dedup_lock;	/* protect dedup_root and entry refcounts */
+	struct rb_root dedup_root;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;	/* protect compression buffers against
-				 * concurrent writes */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -117,6 +181,19 @@ struct zram {
 	 */
 	u64 disksize;	/* bytes */
 
+	/*
+	 * Optional backing device. Set up before the device is initialized
+	 * and torn down on reset, both under init_lock.
+	 */
+	struct block_device *bdev;
+	char *backing_dev;
+	unsigned long *bitmap;	/* allocated backing device pages */
+	unsigned long nr_bd_pages;
+	unsigned long *huge_bitmap;	/* slots holding ZRAM_UNCOMPRESSED */
+	unsigned int idle_age;	/* seconds */
+	struct mutex wb_lock;	/* serializes zram_writeback() */
+	struct work_struct wb_work;
+
 	struct zram_stats stats;
 };
 
@@ -128,5 +205,20 @@ extern struct attribute_group zram_disk_attr_group;
 
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
+extern int zram_set_backing_dev(struct zram *zram, const char *path);
+extern int zram_writeback(struct zram *zram, enum zram_wb_mode mode);
+
+extern int zram_dedup_init(void);
+extern void zram_dedup_exit(void);
+extern u32 zram_dedup_checksum(const unsigned char *mem);
+extern struct zram_entry *zram_entry_alloc(struct zram *zram,
+		unsigned long handle, unsigned int len, u32 checksum,
+		gfp_t flags);
+extern struct zram_entry *zram_dedup_get(struct zram *zram, u32 checksum,
+		struct zram_entry *prev);
+extern int zram_entry_put(struct zram *zram, struct zram_entry *entry);
+
+extern void zram_comp_strm_stats(struct zram *zram, u64 *num_compr,
+		u64 *compr_time, u64 *num_decompr, u64 *decompr_time);
 
 #endif
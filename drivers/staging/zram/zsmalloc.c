@@ -0,0 +1,767 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+/*
+ * Objects are grouped in size classes, ZS_SIZE_CLASS_DELTA bytes apart.
+ * Each class carves its objects out of "zspages": a few 0-order
+ * (possibly highmem) pages treated as one contiguous area, so that
+ * objects may straddle page boundaries and little space is lost at
+ * the end of a page.
+ *
+ * Callers never see object addresses. zs_malloc() returns a handle,
+ * which zs_map_object() turns into an address for as long as the
+ * object is mapped. Every object slot starts with a back-reference to
+ * its handle, which lets compaction move objects out of sparsely used
+ * zspages and give those pages back to the system.
+ */
+
+#ifdef CONFIG_ZRAM_DEBUG
+#define DEBUG
+#endif
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bitops.h>
+#include <linux/bit_spinlock.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+static DEFINE_PER_CPU(struct mapping_area, zs_map_area);
+
+/* Protects creation and teardown of the per-cpu mapping areas */
+static DEFINE_MUTEX(zs_map_area_lock);
+static int zs_map_area_users;
+
+static int get_size_class_index(int size)
+{
+	int idx = 0;
+
+	if (likely(size > ZS_MIN_ALLOC_SIZE))
+		idx = DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE,
+				ZS_SIZE_CLASS_DELTA);
+
+	return idx;
+}
+
+/*
+ * Pick the zspage size (in pages) which wastes the least space at its
+ * tail for objects of the given size.
+ */
+static int get_pages_per_zspage(int class_size)
+{
+	int i, max_usedpc = 0;
+	int max_usedpc_pages = 1;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		int zspage_size = i * PAGE_SIZE;
+		int waste = zspage_size % class_size;
+		int usedpc = (zspage_size - waste) * 100 / zspage_size;
+
+		if (usedpc > max_usedpc) {
+			max_usedpc = usedpc;
+			max_usedpc_pages = i;
+		}
+	}
+
+	return max_usedpc_pages;
+}
+
+static enum fullness_group get_fullness_group(struct size_class *class,
+					struct zspage *zspage)
+{
+	int inuse = zspage->inuse;
+	int max_objs = class->objs_per_zspage;
+
+	if (inuse == 0)
+		return ZS_EMPTY;
+	if (inuse == max_objs)
+		return ZS_FULL;
+	if (inuse * 4 <= max_objs * ZS_ALMOST_FULL_THRESHOLD)
+		return ZS_ALMOST_EMPTY;
+
+	return ZS_ALMOST_FULL;
+}
+
+static void insert_zspage(struct size_class *class, struct zspage *zspage,
+			enum fullness_group fullness)
+{
+	zspage->fullness = fullness;
+	if (fullness < _ZS_NR_FULLNESS_GROUPS)
+		list_add(&zspage->list, &class->fullness_list[fullness]);
+}
+
+static void remove_zspage(struct size_class *class, struct zspage *zspage)
+{
+	if (zspage->fullness < _ZS_NR_FULLNESS_GROUPS)
+		list_del_init(&zspage->list);
+	zspage->fullness = ZS_EMPTY;
+}
+
+/*
+ * Move a zspage to the list matching its current number of objects.
+ * Empty zspages are not kept on any list.
+ */
+static enum fullness_group fix_fullness_group(struct size_class *class,
+					struct zspage *zspage)
+{
+	enum fullness_group newfg;
+
+	newfg = get_fullness_group(class, zspage);
+	if (newfg != zspage->fullness) {
+		remove_zspage(class, zspage);
+		insert_zspage(class, zspage, newfg);
+	}
+
+	return newfg;
+}
+
+/*
+ * Copy a whole object slot (header included) between a zspage and a
+ * linear buffer, coping with objects that straddle two pages.
+ */
+static void obj_copy(struct size_class *class, struct zspage *zspage,
+			unsigned int obj_idx, char *buf, int to_buf)
+{
+	unsigned long off = (unsigned long)obj_idx * class->size;
+	int page_idx = off >> PAGE_SHIFT;
+	int offset = off & ~PAGE_MASK;
+	int size = class->size;
+
+	while (size) {
+		int len = min_t(int, size, PAGE_SIZE - offset);
+		char *addr = kmap_atomic(zspage->pages[page_idx], KM_USER1);
+
+		if (to_buf)
+			memcpy(buf, addr + offset, len);
+		else
+			memcpy(addr + offset, buf, len);
+		kunmap_atomic(addr, KM_USER1);
+
+		buf += len;
+		size -= len;
+		offset = 0;
+		page_idx++;
+	}
+}
+
+/*
+ * Object headers are word aligned and so never straddle pages.
+ */
+static unsigned long read_obj_header(struct size_class *class,
+			struct zspage *zspage, unsigned int obj_idx)
+{
+	unsigned long off = (unsigned long)obj_idx * class->size;
+	unsigned long val;
+	char *addr;
+
+	addr = kmap_atomic(zspage->pages[off >> PAGE_SHIFT], KM_USER1);
+	val = *(unsigned long *)(addr + (off & ~PAGE_MASK));
+	kunmap_atomic(addr, KM_USER1);
+
+	return val;
+}
+
+static void write_obj_header(struct size_class *class,
+			struct zspage *zspage, unsigned int obj_idx,
+			unsigned long val)
+{
+	unsigned long off = (unsigned long)obj_idx * class->size;
+	char *addr;
+
+	addr = kmap_atomic(zspage->pages[off >> PAGE_SHIFT], KM_USER1);
+	*(unsigned long *)(addr + (off & ~PAGE_MASK)) = val;
+	kunmap_atomic(addr, KM_USER1);
+}
+
+static void free_zspage(struct zs_pool *pool, struct size_class *class,
+			struct zspage *zspage)
+{
+	int i;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		if (zspage->pages[i])
+			__free_page(zspage->pages[i]);
+	}
+
+	atomic_long_sub(class->pages_per_zspage, &pool->pages_allocated);
+	kfree(zspage);
+}
+
+static struct zspage *alloc_zspage(struct zs_pool *pool,
+			struct size_class *class, gfp_t flags)
+{
+	int i;
+	struct zspage *zspage;
+
+	zspage = kzalloc(sizeof(*zspage), flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	INIT_LIST_HEAD(&zspage->list);
+	zspage->class_idx = class->index;
+	zspage->fullness = ZS_EMPTY;
+
+	atomic_long_add(class->pages_per_zspage, &pool->pages_allocated);
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		zspage->pages[i] = alloc_page(flags);
+		if (!zspage->pages[i]) {
+			free_zspage(pool, class, zspage);
+			return NULL;
+		}
+	}
+
+	/* Chain all slots into the free list */
+	for (i = 0; i < class->objs_per_zspage; i++) {
+		unsigned long next = i + 1;
+
+		if (next == class->objs_per_zspage)
+			next = OBJ_NO_FREE;
+		write_obj_header(class, zspage, i, next << OBJ_TAG_BITS);
+	}
+	zspage->freeobj = 0;
+
+	return zspage;
+}
+
+static struct zspage *find_get_zspage(struct size_class *class)
+{
+	int i;
+
+	for (i = ZS_ALMOST_FULL; i <= ZS_ALMOST_EMPTY; i++) {
+		if (!list_empty(&class->fullness_list[i]))
+			return list_first_entry(&class->fullness_list[i],
+						struct zspage, list);
+	}
+
+	return NULL;
+}
+
+/* Called with class->lock held */
+static unsigned int obj_malloc(struct size_class *class,
+			struct zspage *zspage, struct zs_handle *handle)
+{
+	unsigned int obj_idx = zspage->freeobj;
+
+	zspage->freeobj = read_obj_header(class, zspage, obj_idx) >>
+				OBJ_TAG_BITS;
+	write_obj_header(class, zspage, obj_idx,
+			(unsigned long)handle | OBJ_ALLOCATED_TAG);
+	zspage->inuse++;
+	class->obj_used++;
+
+	handle->zspage = zspage;
+	handle->obj_idx = obj_idx;
+
+	return obj_idx;
+}
+
+/* Called with class->lock held */
+static void obj_free(struct size_class *class, struct zspage *zspage,
+			unsigned int obj_idx)
+{
+	write_obj_header(class, zspage, obj_idx,
+			(unsigned long)zspage->freeobj << OBJ_TAG_BITS);
+	zspage->freeobj = obj_idx;
+	zspage->inuse--;
+	class->obj_used--;
+}
+
+/**
+ * zs_malloc - Allocate block of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of block to allocate
+ * @flags: flags for the backing pages and handle
+ *
+ * Returns an opaque handle, or 0 on failure. The object has to be
+ * mapped with zs_map_object() to be accessed.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size, gfp_t flags)
+{
+	struct zs_handle *handle;
+	struct size_class *class;
+	struct zspage *zspage;
+
+	size += ZS_HANDLE_SIZE;
+	if (unlikely(size > ZS_MAX_ALLOC_SIZE))
+		return 0;
+
+	handle = kmem_cache_alloc(pool->handle_cachep,
+				flags & ~__GFP_HIGHMEM);
+	if (!handle)
+		return 0;
+	handle->lock = 0;
+
+	class = &pool->size_class[get_size_class_index(size)];
+
+	spin_lock(&class->lock);
+	zspage = find_get_zspage(class);
+	if (!zspage) {
+		spin_unlock(&class->lock);
+		zspage = alloc_zspage(pool, class, flags);
+		if (unlikely(!zspage)) {
+			kmem_cache_free(pool->handle_cachep, handle);
+			return 0;
+		}
+
+		spin_lock(&class->lock);
+		class->obj_allocated += class->objs_per_zspage;
+	}
+
+	obj_malloc(class, zspage, handle);
+	fix_fullness_group(class, zspage);
+	spin_unlock(&class->lock);
+
+	return (unsigned long)handle;
+}
+EXPORT_SYMBOL_GPL(zs_malloc);
+
+/**
+ * zs_free - Free block
+ * @pool: pool the block was allocated from
+ * @handle: handle returned by zs_malloc()
+ */
+void zs_free(struct zs_pool *pool, unsigned long handle)
+{
+	struct zs_handle *h = (struct zs_handle *)handle;
+	enum fullness_group fullness;
+	struct size_class *class;
+	struct zspage *zspage;
+
+	if (unlikely(!handle))
+		return;
+
+	/* Keep compaction from moving the object under us */
+	bit_spin_lock(HANDLE_PIN_BIT, &h->lock);
+	zspage = h->zspage;
+	class = &pool->size_class[zspage->class_idx];
+
+	spin_lock(&class->lock);
+	obj_free(class, zspage, h->obj_idx);
+	fullness = fix_fullness_group(class, zspage);
+	if (fullness == ZS_EMPTY)
+		class->obj_allocated -= class->objs_per_zspage;
+	spin_unlock(&class->lock);
+
+	bit_spin_unlock(HANDLE_PIN_BIT, &h->lock);
+
+	/* Nobody can find an empty zspage anymore */
+	if (fullness == ZS_EMPTY)
+		free_zspage(pool, class, zspage);
+
+	kmem_cache_free(pool->handle_cachep, h);
+}
+EXPORT_SYMBOL_GPL(zs_free);
+
+/**
+ * zs_map_object - get address of allocated object from handle.
+ * @pool: pool the object belongs to
+ * @handle: handle returned by zs_malloc()
+ *
+ * The object is pinned, and preemption disabled, until the matching
+ * zs_unmap_object(). Only one object may be mapped per CPU at a time.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long handle)
+{
+	struct zs_handle *h = (struct zs_handle *)handle;
+	struct mapping_area *area;
+	struct size_class *class;
+	unsigned long off;
+	int offset;
+
+	BUG_ON(!handle);
+
+	bit_spin_lock(HANDLE_PIN_BIT, &h->lock);
+
+	class = &pool->size_class[h->zspage->class_idx];
+	off = (unsigned long)h->obj_idx * class->size;
+	offset = off & ~PAGE_MASK;
+
+	area = &__get_cpu_var(zs_map_area);
+	if (likely(offset + class->size <= PAGE_SIZE)) {
+		area->vm_addr = kmap_atomic(h->zspage->pages[off >> PAGE_SHIFT],
+					KM_USER1);
+		return area->vm_addr + offset + ZS_HANDLE_SIZE;
+	}
+
+	/* The object straddles two pages: hand out a copy */
+	area->vm_addr = NULL;
+	area->class = class;
+	area->zspage = h->zspage;
+	area->obj_idx = h->obj_idx;
+	obj_copy(class, h->zspage, h->obj_idx, area->vm_buf, 1);
+
+	return area->vm_buf + ZS_HANDLE_SIZE;
+}
+EXPORT_SYMBOL_GPL(zs_map_object);
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
+{
+	struct zs_handle *h = (struct zs_handle *)handle;
+	struct mapping_area *area;
+
+	area = &__get_cpu_var(zs_map_area);
+	if (likely(area->vm_addr))
+		kunmap_atomic(area->vm_addr, KM_USER1);
+	else
+		obj_copy(area->class, area->zspage, area->obj_idx,
+			area->vm_buf, 0);
+
+	bit_spin_unlock(HANDLE_PIN_BIT, &h->lock);
+}
+EXPORT_SYMBOL_GPL(zs_unmap_object);
+
+/*
+ * Pick the zspage with the fewest objects among those not full.
+ */
+static struct zspage *find_sparse_zspage(struct size_class *class)
+{
+	int i;
+	struct zspage *zspage, *sparse = NULL;
+
+	for (i = ZS_ALMOST_FULL; i <= ZS_ALMOST_EMPTY; i++) {
+		list_for_each_entry(zspage, &class->fullness_list[i], list) {
+			if (!sparse || zspage->inuse < sparse->inuse)
+				sparse = zspage;
+		}
+	}
+
+	return sparse;
+}
+
+/*
+ * Move all objects of @src into other zspages of the class. @src must
+ * be off the fullness lists, so it is never picked as a destination.
+ * Fails with -EBUSY if some object is currently mapped or being freed.
+ */
+static int migrate_zspage(struct zs_pool *pool, struct size_class *class,
+			struct zspage *src)
+{
+	unsigned int obj_idx;
+
+	for (obj_idx = 0; obj_idx < class->objs_per_zspage && src->inuse;
+			obj_idx++) {
+		unsigned long head;
+		struct zs_handle *h;
+		struct zspage *dst;
+
+		head = read_obj_header(class, src, obj_idx);
+		if (!(head & OBJ_ALLOCATED_TAG))
+			continue;
+
+		h = (struct zs_handle *)(head & ~OBJ_ALLOCATED_TAG);
+		if (!bit_spin_trylock(HANDLE_PIN_BIT, &h->lock))
+			return -EBUSY;
+
+		dst = find_get_zspage(class);
+		if (WARN_ON(!dst)) {
+			bit_spin_unlock(HANDLE_PIN_BIT, &h->lock);
+			return -ENOSPC;
+		}
+
+		obj_copy(class, src, obj_idx, pool->compact_buf, 1);
+		obj_copy(class, dst, obj_malloc(class, dst, h),
+			pool->compact_buf, 0);
+		fix_fullness_group(class, dst);
+		obj_free(class, src, obj_idx);
+
+		bit_spin_unlock(HANDLE_PIN_BIT, &h->lock);
+	}
+
+	return 0;
+}
+
+/*
+ * Empty sparse zspages of a class for as long as the free slots of
+ * the other zspages can take their objects, until about @budget pages
+ * are freed. Returns no. of pages freed.
+ */
+static unsigned long zs_compact_class(struct zs_pool *pool,
+			struct size_class *class, unsigned long budget)
+{
+	unsigned long freed = 0;
+
+	spin_lock(&class->lock);
+	while (freed < budget && class->obj_allocated - class->obj_used >=
+			class->objs_per_zspage) {
+		struct zspage *src;
+		int ret;
+
+		src = find_sparse_zspage(class);
+		if (!src)
+			break;
+
+		remove_zspage(class, src);
+		ret = migrate_zspage(pool, class, src);
+
+		if (!src->inuse) {
+			class->obj_allocated -= class->objs_per_zspage;
+			free_zspage(pool, class, src);
+			freed += class->pages_per_zspage;
+		} else {
+			fix_fullness_group(class, src);
+		}
+
+		/* Some object is in use, try again next time */
+		if (ret)
+			break;
+
+		spin_unlock(&class->lock);
+		cond_resched();
+		spin_lock(&class->lock);
+	}
+	spin_unlock(&class->lock);
+
+	return freed;
+}
+
+static unsigned long __zs_compact(struct zs_pool *pool, unsigned long budget)
+{
+	int i;
+	unsigned long freed = 0;
+
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0 && freed < budget; i--)
+		freed += zs_compact_class(pool, &pool->size_class[i],
+					budget - freed);
+
+	pool->pages_compacted += freed;
+	pool->num_compactions++;
+
+	return freed;
+}
+
+/**
+ * zs_compact - move objects to release sparsely used pages
+ * @pool: pool to compact
+ *
+ * Returns the number of pages given back to the system.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	unsigned long freed;
+
+	mutex_lock(&pool->compact_lock);
+	freed = __zs_compact(pool, ULONG_MAX);
+	mutex_unlock(&pool->compact_lock);
+
+	return freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+/*
+ * Estimate of the no. of pages compaction could give back: every
+ * objs_per_zspage free slots of a class amount to one zspage.
+ */
+static unsigned long zs_compactable_pages(struct zs_pool *pool)
+{
+	int i;
+	unsigned long pages = 0;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+		unsigned long free_objs;
+
+		free_objs = class->obj_allocated - class->obj_used;
+		pages += free_objs / class->objs_per_zspage *
+				class->pages_per_zspage;
+	}
+
+	return pages;
+}
+
+static int zs_shrink(struct shrinker *shrinker, int nr_to_scan,
+			gfp_t gfp_mask)
+{
+	struct zs_pool *pool = container_of(shrinker, struct zs_pool,
+					shrinker);
+
+	/*
+	 * shrink_slab() calls us in batches, so free about nr_to_scan pages
+	 * per call rather than compacting the whole pool each time.
+	 */
+	if (nr_to_scan) {
+		if (!mutex_trylock(&pool->compact_lock))
+			return -1;
+		__zs_compact(pool, nr_to_scan);
+		mutex_unlock(&pool->compact_lock);
+	}
+
+	return zs_compactable_pages(pool);
+}
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_long_read(&pool->pages_allocated) << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
+
+void zs_get_stats(struct zs_pool *pool, struct zs_pool_stats *stats)
+{
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		spin_lock(&class->lock);
+		stats->obj_allocated += (u64)class->obj_allocated * class->size;
+		stats->obj_used += (u64)class->obj_used * class->size;
+		spin_unlock(&class->lock);
+	}
+
+	mutex_lock(&pool->compact_lock);
+	stats->pages_compacted = pool->pages_compacted;
+	stats->num_compactions = pool->num_compactions;
+	mutex_unlock(&pool->compact_lock);
+}
+EXPORT_SYMBOL_GPL(zs_get_stats);
+
+static void zs_free_map_areas(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct mapping_area *area = &per_cpu(zs_map_area, cpu);
+
+		kfree(area->vm_buf);
+		area->vm_buf = NULL;
+	}
+}
+
+static int zs_get_map_areas(void)
+{
+	int cpu, ret = 0;
+
+	mutex_lock(&zs_map_area_lock);
+	if (zs_map_area_users++)
+		goto out;
+
+	for_each_possible_cpu(cpu) {
+		struct mapping_area *area = &per_cpu(zs_map_area, cpu);
+
+		area->vm_buf = kmalloc(ZS_MAX_ALLOC_SIZE, GFP_KERNEL);
+		if (!area->vm_buf) {
+			zs_free_map_areas();
+			zs_map_area_users--;
+			ret = -ENOMEM;
+			break;
+		}
+	}
+
+out:
+	mutex_unlock(&zs_map_area_lock);
+	return ret;
+}
+
+static void zs_put_map_areas(void)
+{
+	mutex_lock(&zs_map_area_lock);
+	if (!--zs_map_area_users)
+		zs_free_map_areas();
+	mutex_unlock(&zs_map_area_lock);
+}
+
+/**
+ * zs_create_pool - Creates an allocation pool to work from.
+ * @name: name of the pool, used for the handle slab cache
+ *
+ * Returns NULL on failure.
+ */
+struct zs_pool *zs_create_pool(const char *name)
+{
+	int i;
+	struct zs_pool *pool;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	strlcpy(pool->name, name, sizeof(pool->name));
+	mutex_init(&pool->compact_lock);
+	atomic_long_set(&pool->pages_allocated, 0);
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+		int fg;
+
+		spin_lock_init(&class->lock);
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++)
+			INIT_LIST_HEAD(&class->fullness_list[fg]);
+
+		class->index = i;
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage *
+					PAGE_SIZE / class->size;
+	}
+
+	pool->handle_cachep = kmem_cache_create(pool->name,
+				sizeof(struct zs_handle), 0, 0, NULL);
+	if (!pool->handle_cachep)
+		goto free_pool;
+
+	pool->compact_buf = kmalloc(ZS_MAX_ALLOC_SIZE, GFP_KERNEL);
+	if (!pool->compact_buf)
+		goto free_cache;
+
+	if (zs_get_map_areas())
+		goto free_buf;
+
+	pool->shrinker.shrink = zs_shrink;
+	pool->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&pool->shrinker);
+
+	return pool;
+
+free_buf:
+	kfree(pool->compact_buf);
+free_cache:
+	kmem_cache_destroy(pool->handle_cachep);
+free_pool:
+	kfree(pool);
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(zs_create_pool);
+
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int i;
+
+	unregister_shrinker(&pool->shrinker);
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+		struct zspage *zspage, *tmp;
+		int fg;
+
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++) {
+			list_for_each_entry_safe(zspage, tmp,
+					&class->fullness_list[fg], list) {
+				pr_info("Freeing non-empty zspage of class %d\n",
+					class->size);
+				list_del(&zspage->list);
+				free_zspage(pool, class, zspage);
+			}
+		}
+	}
+
+	zs_put_map_areas();
+	kfree(pool->compact_buf);
+	kmem_cache_destroy(pool->handle_cachep);
+	kfree(pool);
+}
+EXPORT_SYMBOL_GPL(zs_destroy_pool);
@@ -0,0 +1,136 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+/* User configurable params */
+
+/*
+ * A zspage is made of up to this many 0-order pages. Objects are
+ * packed back to back and may straddle a page boundary, so larger
+ * zspages waste less space at the tail for big size classes.
+ */
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+
+/*
+ * Size classes are separated by this many bytes. Must be a multiple
+ * of sizeof(unsigned long) so that object headers never straddle.
+ * This value is 16 for 4k pages.
+ */
+#define ZS_SIZE_CLASS_DELTA	(PAGE_SIZE >> 8)
+
+/* End of user params */
+
+#define ZS_SIZE_CLASSES	((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) / \
+				ZS_SIZE_CLASS_DELTA + 1)
+
+/*
+ * Every object slot starts with a header word. For an allocated object
+ * it holds the handle with OBJ_ALLOCATED_TAG set (handles are pointers,
+ * so bit 0 is free); for a free slot it holds the index of the next
+ * free slot shifted by OBJ_TAG_BITS.
+ */
+#define ZS_HANDLE_SIZE		sizeof(unsigned long)
+#define OBJ_ALLOCATED_TAG	1
+#define OBJ_TAG_BITS		1
+#define OBJ_NO_FREE		0xffff
+
+/* Bit lock in zs_handle->lock, held while an object is mapped */
+#define HANDLE_PIN_BIT		0
+
+/*
+ * Compaction moves objects out of zspages with at most this fraction
+ * of used slots (in 1/4 units) first.
+ */
+#define ZS_ALMOST_FULL_THRESHOLD	3
+
+enum fullness_group {
+	ZS_ALMOST_FULL,
+	ZS_ALMOST_EMPTY,
+	ZS_FULL,
+	_ZS_NR_FULLNESS_GROUPS,
+
+	ZS_EMPTY,
+};
+
+/*
+ * What a zs_malloc() handle points to. It never moves, so users may
+ * store the handle; compaction only rewrites zspage/obj_idx.
+ */
+struct zs_handle {
+	unsigned long lock;
+	struct zspage *zspage;
+	u16 obj_idx;
+};
+
+struct zspage {
+	struct list_head list;	/* in size_class->fullness_list[] */
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+	u16 inuse;		/* no. of allocated objects */
+	u16 freeobj;		/* first free slot or OBJ_NO_FREE */
+	u16 class_idx;
+	u8 fullness;		/* enum fullness_group */
+};
+
+struct size_class {
+	spinlock_t lock;
+	struct list_head fullness_list[_ZS_NR_FULLNESS_GROUPS];
+
+	int size;		/* object size including header */
+	int index;
+	int pages_per_zspage;
+	int objs_per_zspage;
+
+	/* Protected by lock */
+	unsigned long obj_allocated;	/* slots in all zspages */
+	unsigned long obj_used;
+};
+
+struct zs_pool {
+	struct size_class size_class[ZS_SIZE_CLASSES];
+
+	struct kmem_cache *handle_cachep;
+	atomic_long_t pages_allocated;
+
+	/* Serializes compaction; protects compact_buf and the stats below */
+	struct mutex compact_lock;
+	void *compact_buf;
+	u64 pages_compacted;
+	u64 num_compactions;
+
+	struct shrinker shrinker;
+	char name[16];
+};
+
+/*
+ * Per-cpu area used to present an object that straddles two pages of
+ * its zspage as one contiguous buffer. Only one object can be mapped
+ * per CPU at a time.
+ */
+struct mapping_area {
+	char *vm_buf;		/* copy of a straddling object */
+	char *vm_addr;		/* kmap'ed page, NULL if vm_buf is used */
+	struct size_class *class;
+	struct zspage *zspage;
+	unsigned int obj_idx;
+};
+
+#endif
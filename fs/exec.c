@@ -922,6 +922,8 @@ static int de_thread(struct task_struct *tsk)
 		leader->exit_state = EXIT_DEAD;
 		write_unlock_irq(&tasklist_lock);
 
+		/* tsk now stands for the process */
+		oom_adj_notify(tsk);
 		release_task(leader);
 	}
 
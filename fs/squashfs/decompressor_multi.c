@@ -0,0 +1,292 @@
+/*
+ * Squashfs - a compressed read only filesystem for Linux
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * decompressor_multi.c
+ */
+
+#include <linux/types.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/buffer_head.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
+
+#include "squashfs_fs.h"
+#include "squashfs_fs_sb.h"
+#include "decompressor.h"
+#include "squashfs.h"
+
+/*
+ * This file manages the decompressor streams of a mounted filesystem.
+ *
+ * A stream holds the decompressor state and buffers and can only be used
+ * by one block read at a time.  With the default "threads=single" there
+ * is one stream, and concurrent readers decompress one block after the
+ * other.  "threads=<n>" (or "multi", two per online CPU) keeps a pool of
+ * up to n streams which are allocated when all existing ones are busy.
+ * "threads=percpu" allocates one stream per possible CPU at mount time,
+ * and a reader uses the stream of the CPU it starts on.
+ */
+
+struct squashfs_stream {
+	void			*stream;
+	struct list_head	list;
+};
+
+struct squashfs_percpu_stream {
+	void			*stream;
+	struct mutex		mutex;
+};
+
+struct squashfs_streams {
+	/* Pool of streams, used unless percpu is set */
+	spinlock_t		lock;
+	struct list_head	idle;
+	int			created;
+	int			max;
+	wait_queue_head_t	wait;
+	/* Compression options, needed to create more streams */
+	void			*comp_opts;
+	int			comp_opts_len;
+
+	struct squashfs_percpu_stream __percpu *percpu;
+};
+
+
+static struct squashfs_stream *stream_alloc(struct squashfs_sb_info *msblk,
+	struct squashfs_streams *streams)
+{
+	struct squashfs_stream *stream;
+
+	stream = kmalloc(sizeof(*stream), GFP_KERNEL);
+	if (stream == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	stream->stream = msblk->decompressor->init(msblk, streams->comp_opts,
+		streams->comp_opts_len);
+	if (IS_ERR(stream->stream)) {
+		int err = PTR_ERR(stream->stream);
+
+		kfree(stream);
+		return ERR_PTR(err);
+	}
+
+	return stream;
+}
+
+
+static struct squashfs_stream *get_stream(struct squashfs_sb_info *msblk,
+	struct squashfs_streams *streams)
+{
+	struct squashfs_stream *stream;
+
+	while (1) {
+		spin_lock(&streams->lock);
+		if (!list_empty(&streams->idle)) {
+			stream = list_first_entry(&streams->idle,
+				struct squashfs_stream, list);
+			list_del(&stream->list);
+			spin_unlock(&streams->lock);
+			return stream;
+		}
+
+		if (streams->created < streams->max) {
+			streams->created++;
+			spin_unlock(&streams->lock);
+
+			stream = stream_alloc(msblk, streams);
+			if (!IS_ERR(stream))
+				return stream;
+
+			/*
+			 * Out of memory.  There is at least the stream
+			 * allocated at mount time, wait for it.
+			 */
+			spin_lock(&streams->lock);
+			streams->created--;
+		}
+		spin_unlock(&streams->lock);
+
+		wait_event(streams->wait, !list_empty(&streams->idle));
+	}
+}
+
+
+static void put_stream(struct squashfs_streams *streams,
+	struct squashfs_stream *stream)
+{
+	spin_lock(&streams->lock);
+	list_add(&stream->list, &streams->idle);
+	spin_unlock(&streams->lock);
+
+	wake_up(&streams->wait);
+}
+
+
+int squashfs_decompress(struct squashfs_sb_info *msblk, void **buffer,
+	struct buffer_head **bh, int b, int offset, int length, int srclength,
+	int pages)
+{
+	struct squashfs_streams *streams = msblk->stream;
+	int res;
+
+	if (streams->percpu) {
+		struct squashfs_percpu_stream *pcs;
+
+		pcs = per_cpu_ptr(streams->percpu, get_cpu());
+		put_cpu();
+
+		/*
+		 * The decompressors wait for buffer I/O, so a reader can be
+		 * migrated or sleep while holding the stream.  A reader that
+		 * starts on the same CPU meanwhile waits for it.
+		 */
+		mutex_lock(&pcs->mutex);
+		res = msblk->decompressor->decompress(msblk, pcs->stream,
+			buffer, bh, b, offset, length, srclength, pages);
+		mutex_unlock(&pcs->mutex);
+	} else {
+		struct squashfs_stream *stream = get_stream(msblk, streams);
+
+		res = msblk->decompressor->decompress(msblk, stream->stream,
+			buffer, bh, b, offset, length, srclength, pages);
+		put_stream(streams, stream);
+	}
+
+	return res;
+}
+
+
+/*
+ * Number of block reads which can decompress at the same time.
+ */
+int squashfs_max_decompressors(struct squashfs_sb_info *msblk)
+{
+	if (msblk->threads == SQUASHFS_THREADS_PERCPU)
+		return num_possible_cpus();
+
+	return msblk->threads;
+}
+
+
+static int percpu_streams_init(struct squashfs_sb_info *msblk,
+	struct squashfs_streams *streams, void *comp_opts, int length)
+{
+	struct squashfs_percpu_stream *pcs;
+	int cpu;
+
+	streams->percpu = alloc_percpu(struct squashfs_percpu_stream);
+	if (streams->percpu == NULL)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		pcs = per_cpu_ptr(streams->percpu, cpu);
+		mutex_init(&pcs->mutex);
+		pcs->stream = msblk->decompressor->init(msblk, comp_opts,
+			length);
+		if (IS_ERR(pcs->stream)) {
+			int err = PTR_ERR(pcs->stream);
+
+			pcs->stream = NULL;
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+
+int squashfs_streams_init(struct squashfs_sb_info *msblk, void *comp_opts,
+	int length)
+{
+	struct squashfs_streams *streams;
+	struct squashfs_stream *stream;
+	int err;
+
+	streams = kzalloc(sizeof(*streams), GFP_KERNEL);
+	if (streams == NULL)
+		return -ENOMEM;
+
+	spin_lock_init(&streams->lock);
+	INIT_LIST_HEAD(&streams->idle);
+	init_waitqueue_head(&streams->wait);
+	msblk->stream = streams;
+
+	if (msblk->threads == SQUASHFS_THREADS_PERCPU) {
+		err = percpu_streams_init(msblk, streams, comp_opts, length);
+		if (err)
+			goto failed;
+		return 0;
+	}
+
+	if (length) {
+		streams->comp_opts = kmemdup(comp_opts, length, GFP_KERNEL);
+		if (streams->comp_opts == NULL) {
+			err = -ENOMEM;
+			goto failed;
+		}
+		streams->comp_opts_len = length;
+	}
+	streams->max = msblk->threads;
+
+	/* Always have one stream, so readers never fail for lack of one */
+	stream = stream_alloc(msblk, streams);
+	if (IS_ERR(stream)) {
+		err = PTR_ERR(stream);
+		goto failed;
+	}
+	streams->created = 1;
+	list_add(&stream->list, &streams->idle);
+
+	return 0;
+
+failed:
+	squashfs_streams_free(msblk);
+	return err;
+}
+
+
+void squashfs_streams_free(struct squashfs_sb_info *msblk)
+{
+	struct squashfs_streams *streams = msblk->stream;
+	struct squashfs_stream *stream, *next;
+	int cpu;
+
+	if (streams == NULL)
+		return;
+
+	if (streams->percpu) {
+		for_each_possible_cpu(cpu) {
+			struct squashfs_percpu_stream *pcs =
+				per_cpu_ptr(streams->percpu, cpu);
+
+			if (pcs->stream)
+				msblk->decompressor->free(pcs->stream);
+		}
+		free_percpu(streams->percpu);
+	}
+
+	list_for_each_entry_safe(stream, next, &streams->idle, list) {
+		msblk->decompressor->free(stream->stream);
+		kfree(stream);
+	}
+
+	kfree(streams->comp_opts);
+	kfree(streams);
+	msblk->stream = NULL;
+}
@@ -371,26 +371,138 @@ static int read_blocklist(struct inode *inode, int index, u64 *block)
 }
 
 
-static int squashfs_readpage(struct file *file, struct page *page)
+/*
+ * Number of pages of datablock @index which are inside the file.
+ */
+static int squashfs_block_pages(struct inode *inode, int index)
 {
-	struct inode *inode = page->mapping->host;
 	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
-	int bytes, i, offset = 0, sparse = 0;
-	struct squashfs_cache_entry *buffer = NULL;
+	int shift = msblk->block_log - PAGE_CACHE_SHIFT;
+	int file_pages = (i_size_read(inode) + PAGE_CACHE_SIZE - 1) >>
+		PAGE_CACHE_SHIFT;
+
+	return min(1 << shift, file_pages - (index << shift));
+}
+
+
+/*
+ * Copy a decompressed block (or zeroes, if buffer is NULL) into the pages
+ * which are not yet uptodate.  Page[0] is filled from offset, page[1] from
+ * offset + PAGE_CACHE_SIZE and so on, bytes is the amount of data from
+ * offset onwards.
+ */
+static void squashfs_copy_cache(struct page **page, int pages,
+	struct squashfs_cache_entry *buffer, int offset, int bytes)
+{
 	void *pageaddr;
+	int i, avail;
 
-	int mask = (1 << (msblk->block_log - PAGE_CACHE_SHIFT)) - 1;
-	int index = page->index >> (msblk->block_log - PAGE_CACHE_SHIFT);
-	int start_index = page->index & ~mask;
-	int end_index = start_index | mask;
-	int file_end = i_size_read(inode) >> msblk->block_log;
+	for (i = 0; i < pages; i++, bytes -= PAGE_CACHE_SIZE,
+			offset += PAGE_CACHE_SIZE) {
+		if (page[i] == NULL || PageUptodate(page[i]))
+			continue;
 
-	TRACE("Entered squashfs_readpage, page index %lx, start block %llx\n",
-				page->index, squashfs_i(inode)->start);
+		avail = buffer ? clamp_t(int, bytes, 0, PAGE_CACHE_SIZE) : 0;
 
-	if (page->index >= ((i_size_read(inode) + PAGE_CACHE_SIZE - 1) >>
-					PAGE_CACHE_SHIFT))
+		TRACE("bytes %d, i %d, available_bytes %d\n", bytes, i, avail);
+
+		pageaddr = kmap_atomic(page[i], KM_USER0);
+		squashfs_copy_data(pageaddr, buffer, offset, avail);
+		memset(pageaddr + avail, 0, PAGE_CACHE_SIZE - avail);
+		kunmap_atomic(pageaddr, KM_USER0);
+		flush_dcache_page(page[i]);
+		SetPageUptodate(page[i]);
+	}
+}
+
+
+/*
+ * Decompress a datablock straight into its page cache pages, avoiding the
+ * read_page cache and the copy out of it.  Page[] holds the locked pages
+ * of the block, missing and already uptodate pages are decompressed into
+ * a scratch page and thrown away.  Returns -EAGAIN if the block has to be
+ * read through the cache instead.
+ */
+static int squashfs_read_direct(struct inode *inode, u64 block, int bsize,
+	struct page **page, int pages)
+{
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int i, avail, res, block_pages = msblk->block_size >> PAGE_CACHE_SHIFT;
+	void **pageaddr, *scratch = NULL;
+
+	/*
+	 * The decompressors may sleep between pages, so highmem pages would
+	 * have to stay kmapped for the whole block.  Leave those to the
+	 * cache, which copies a page at a time.
+	 */
+	for (i = 0; i < pages; i++)
+		if (page[i] && PageHighMem(page[i]))
+			return -EAGAIN;
+
+	pageaddr = kmalloc(block_pages * sizeof(void *), GFP_KERNEL);
+	if (pageaddr == NULL)
+		return -EAGAIN;
+
+	/*
+	 * The pages past the end of the file are scratch too, a corrupted
+	 * block can decompress to more than the file size says.
+	 */
+	for (i = 0; i < block_pages; i++) {
+		if (i < pages && page[i] && !PageUptodate(page[i])) {
+			pageaddr[i] = page_address(page[i]);
+			continue;
+		}
+
+		if (scratch == NULL) {
+			scratch = kmalloc(PAGE_CACHE_SIZE, GFP_KERNEL);
+			if (scratch == NULL) {
+				res = -EAGAIN;
+				goto out;
+			}
+		}
+		pageaddr[i] = scratch;
+	}
+
+	res = squashfs_read_data(inode->i_sb, pageaddr, block, bsize, NULL,
+		msblk->block_size, block_pages);
+	if (res < 0) {
+		ERROR("Unable to read page, block %llx, size %x\n", block,
+			bsize);
 		goto out;
+	}
+
+	for (i = 0; i < pages; i++) {
+		if (pageaddr[i] == scratch)
+			continue;
+
+		avail = clamp_t(int, res - i * PAGE_CACHE_SIZE, 0,
+			PAGE_CACHE_SIZE);
+		memset(pageaddr[i] + avail, 0, PAGE_CACHE_SIZE - avail);
+		flush_dcache_page(page[i]);
+		SetPageUptodate(page[i]);
+	}
+	res = 0;
+
+out:
+	kfree(scratch);
+	kfree(pageaddr);
+	return res;
+}
+
+
+/*
+ * Fill pages first to first + pages - 1 of datablock index of the file,
+ * page[0] being page first.  Page[] entries are locked or NULL, pages
+ * which are already uptodate are left alone.
+ */
+static int squashfs_fill_pages(struct inode *inode, int index,
+	struct page **page, int first, int pages)
+{
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	struct squashfs_cache_entry *buffer;
+	int file_end = i_size_read(inode) >> msblk->block_log;
+	int offset = first * PAGE_CACHE_SIZE;
+	int bytes, res;
 
 	if (index < file_end || squashfs_i(inode)->fragment_block ==
 					SQUASHFS_INVALID_BLK) {
@@ -401,27 +513,35 @@ static int squashfs_readpage(struct file *file, struct page *page)
 		u64 block = 0;
 		int bsize = read_blocklist(inode, index, &block);
 		if (bsize < 0)
-			goto error_out;
+			return bsize;
 
 		if (bsize == 0) { /* hole */
-			bytes = index == file_end ?
-				(i_size_read(inode) & (msblk->block_size - 1)) :
-				 msblk->block_size;
-			sparse = 1;
-		} else {
-			/*
-			 * Read and decompress datablock.
-			 */
-			buffer = squashfs_get_datablock(inode->i_sb,
-								block, bsize);
-			if (buffer->error) {
-				ERROR("Unable to read page, block %llx, size %x"
-					"\n", block, bsize);
-				squashfs_cache_put(buffer);
-				goto error_out;
-			}
-			bytes = buffer->length;
+			squashfs_copy_cache(page, pages, NULL, 0, 0);
+			return 0;
 		}
+
+		/*
+		 * If all the pages of the block are here, decompress into
+		 * them directly.
+		 */
+		if (first == 0 && pages == squashfs_block_pages(inode, index)) {
+			res = squashfs_read_direct(inode, block, bsize, page,
+				pages);
+			if (res != -EAGAIN)
+				return res;
+		}
+
+		/*
+		 * Read and decompress datablock.
+		 */
+		buffer = squashfs_get_datablock(inode->i_sb, block, bsize);
+		if (buffer->error) {
+			ERROR("Unable to read page, block %llx, size %x\n",
+				block, bsize);
+			squashfs_cache_put(buffer);
+			return -EIO;
+		}
+		bytes = buffer->length;
 	} else {
 		/*
 		 * Datablock is stored inside a fragment (tail-end packed
@@ -436,49 +556,84 @@ static int squashfs_readpage(struct file *file, struct page *page)
 				squashfs_i(inode)->fragment_block,
 				squashfs_i(inode)->fragment_size);
 			squashfs_cache_put(buffer);
-			goto error_out;
+			return -EIO;
 		}
 		bytes = i_size_read(inode) & (msblk->block_size - 1);
-		offset = squashfs_i(inode)->fragment_offset;
+		offset += squashfs_i(inode)->fragment_offset;
+		bytes += squashfs_i(inode)->fragment_offset;
 	}
 
-	/*
-	 * Loop copying datablock into pages.  As the datablock likely covers
-	 * many PAGE_CACHE_SIZE pages (default block size is 128 KiB) explicitly
-	 * grab the pages from the page cache, except for the page that we've
-	 * been called to fill.
-	 */
-	for (i = start_index; i <= end_index && bytes > 0; i++,
-			bytes -= PAGE_CACHE_SIZE, offset += PAGE_CACHE_SIZE) {
-		struct page *push_page;
-		int avail = sparse ? 0 : min_t(int, bytes, PAGE_CACHE_SIZE);
+	squashfs_copy_cache(page, pages, buffer, offset, bytes - offset);
+	squashfs_cache_put(buffer);
 
-		TRACE("bytes %d, i %d, available_bytes %d\n", bytes, i, avail);
+	return 0;
+}
 
-		push_page = (i == page->index) ? page :
-			grab_cache_page_nowait(page->mapping, i);
 
-		if (!push_page)
+/*
+ * Unlock and release the pages grabbed to fill a block, other than the
+ * page being read (if any).
+ */
+static void squashfs_release_pages(struct page **page, int pages,
+	struct page *keep)
+{
+	int i;
+
+	for (i = 0; i < pages; i++) {
+		if (page[i] == NULL || page[i] == keep)
 			continue;
+		unlock_page(page[i]);
+		page_cache_release(page[i]);
+	}
+}
 
-		if (PageUptodate(push_page))
-			goto skip_page;
 
-		pageaddr = kmap_atomic(push_page, KM_USER0);
-		squashfs_copy_data(pageaddr, buffer, offset, avail);
-		memset(pageaddr + avail, 0, PAGE_CACHE_SIZE - avail);
-		kunmap_atomic(pageaddr, KM_USER0);
-		flush_dcache_page(push_page);
-		SetPageUptodate(push_page);
-skip_page:
-		unlock_page(push_page);
-		if (i != page->index)
-			page_cache_release(push_page);
+static int squashfs_readpage(struct file *file, struct page *page)
+{
+	struct inode *inode = page->mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	struct page **block_page;
+	int i, res, pages;
+	void *pageaddr;
+
+	int mask = (1 << (msblk->block_log - PAGE_CACHE_SHIFT)) - 1;
+	int index = page->index >> (msblk->block_log - PAGE_CACHE_SHIFT);
+	int start_index = page->index & ~mask;
+
+	TRACE("Entered squashfs_readpage, page index %lx, start block %llx\n",
+				page->index, squashfs_i(inode)->start);
+
+	if (page->index >= ((i_size_read(inode) + PAGE_CACHE_SIZE - 1) >>
+					PAGE_CACHE_SHIFT))
+		goto out;
+
+	/*
+	 * As the datablock likely covers many PAGE_CACHE_SIZE pages (default
+	 * block size is 128 KiB) explicitly grab the other pages of the block
+	 * from the page cache, and fill them all.  If there's no memory for
+	 * the page array, just fill the page we've been called to fill.
+	 */
+	pages = squashfs_block_pages(inode, index);
+	block_page = kcalloc(pages, sizeof(*block_page), GFP_KERNEL);
+	if (block_page == NULL) {
+		res = squashfs_fill_pages(inode, index, &page,
+			page->index - start_index, 1);
+		goto done;
 	}
 
-	if (!sparse)
-		squashfs_cache_put(buffer);
+	for (i = 0; i < pages; i++)
+		block_page[i] = (start_index + i == page->index) ? page :
+			grab_cache_page_nowait(page->mapping, start_index + i);
+
+	res = squashfs_fill_pages(inode, index, block_page, 0, pages);
+	squashfs_release_pages(block_page, pages, page);
+	kfree(block_page);
 
+done:
+	if (res)
+		goto error_out;
+
+	unlock_page(page);
 	return 0;
 
 error_out:
@@ -496,6 +651,71 @@ out:
 }
 
 
+/*
+ * Readahead.  The pages are read a datablock at a time: the readahead
+ * pages of the block are added to the page cache, the rest of the block
+ * is grabbed from the page cache, and the block is decompressed into them
+ * all.  Errors are left for squashfs_readpage() to report.
+ */
+static int squashfs_readpages(struct file *file, struct address_space *mapping,
+	struct list_head *pages, unsigned nr_pages)
+{
+	struct inode *inode = mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int shift = msblk->block_log - PAGE_CACHE_SHIFT;
+	struct page **block_page, *page, *next;
+	int i, index, start_index, count, added;
+
+	TRACE("Entered squashfs_readpages, %u pages, start block %llx\n",
+				nr_pages, squashfs_i(inode)->start);
+
+	/* Pages left on the list are freed by the caller */
+	block_page = kmalloc(sizeof(*block_page) << shift, GFP_KERNEL);
+	if (block_page == NULL)
+		return 0;
+
+	while (!list_empty(pages)) {
+		page = list_entry(pages->prev, struct page, lru);
+		index = page->index >> shift;
+		start_index = index << shift;
+		count = squashfs_block_pages(inode, index);
+		added = 0;
+
+		memset(block_page, 0, sizeof(*block_page) << shift);
+
+		list_for_each_entry_safe(page, next, pages, lru) {
+			if ((page->index >> shift) != index)
+				continue;
+
+			list_del(&page->lru);
+			if (page->index - start_index >= count ||
+					add_to_page_cache_lru(page, mapping,
+						page->index, GFP_KERNEL)) {
+				page_cache_release(page);
+				continue;
+			}
+			block_page[page->index - start_index] = page;
+			added++;
+		}
+
+		if (!added)
+			continue;
+
+		for (i = 0; i < count; i++)
+			if (block_page[i] == NULL)
+				block_page[i] = grab_cache_page_nowait(mapping,
+					start_index + i);
+
+		squashfs_fill_pages(inode, index, block_page, 0, count);
+		squashfs_release_pages(block_page, count, NULL);
+	}
+
+	kfree(block_page);
+	return 0;
+}
+
+
 const struct address_space_operations squashfs_aops = {
-	.readpage = squashfs_readpage
+	.readpage = squashfs_readpage,
+	.readpages = squashfs_readpages
 };
@@ -51,6 +51,12 @@ struct squashfs_cache_entry {
 	void			**data;
 };
 
+/* threads= mount option, otherwise the maximum number of streams */
+#define SQUASHFS_THREADS_PERCPU	0
+#define SQUASHFS_THREADS_MAX	64
+
+struct squashfs_streams;
+
 struct squashfs_sb_info {
 	const struct squashfs_decompressor	*decompressor;
 	int					devblksize;
@@ -62,10 +68,10 @@ struct squashfs_sb_info {
 	__le64					*id_table;
 	__le64					*fragment_index;
 	__le64					*xattr_id_table;
-	struct mutex				read_data_mutex;
 	struct mutex				meta_index_mutex;
 	struct meta_index			*meta_index;
-	void					*stream;
+	struct squashfs_streams			*stream;
+	int					threads;
 	__le64					*inode_lookup_table;
 	u64					inode_table;
 	u64					directory_table;
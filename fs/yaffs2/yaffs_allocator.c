@@ -74,6 +74,20 @@ struct yaffs_obj_list {
 	struct yaffs_obj *objects;
 };
 
+/* Refills of the free lists grow with the number of things already made,
+ * so mounting a big device takes a few large allocations rather than
+ * thousands of small ones.  Each refill is capped to keep the allocation
+ * and the unused part of it modest.
+ */
+#define YAFFS_ALLOCATION_MAX_BYTES	(32 * 1024)
+
+static int yaffs_alloc_batch(int n_created, int n_min, int size)
+{
+	int n = max(n_min, n_created / 2);
+
+	return min(n, max(n_min, YAFFS_ALLOCATION_MAX_BYTES / size));
+}
+
 struct yaffs_allocator {
 	int n_tnodes_created;
 	struct yaffs_tnode *free_tnodes;
@@ -204,7 +218,12 @@ struct yaffs_tnode *yaffs_alloc_raw_tnode(struct yaffs_dev *dev)
 		return NULL;
 	}
 
-	/* If there are none left make more */
+	/* If there are none left make more, a small batch if memory is short */
+	if (!allocator->free_tnodes)
+		yaffs_create_tnodes(dev,
+			yaffs_alloc_batch(allocator->n_tnodes_created,
+					  YAFFS_ALLOCATION_NTNODES,
+					  dev->tnode_size));
 	if (!allocator->free_tnodes)
 		yaffs_create_tnodes(dev, YAFFS_ALLOCATION_NTNODES);
 
@@ -243,6 +262,7 @@ static void yaffs_init_raw_objs(struct yaffs_dev *dev)
 		allocator->allocated_obj_list = NULL;
 		allocator->free_objs = NULL;
 		allocator->n_free_objects = 0;
+		allocator->n_obj_created = 0;
 	} else {
 		YBUG();
 	}
@@ -335,7 +355,12 @@ struct yaffs_obj *yaffs_alloc_raw_obj(struct yaffs_dev *dev)
 		return obj;
 	}
 
-	/* If there are none left make more */
+	/* If there are none left make more, a small batch if memory is short */
+	if (!allocator->free_objs)
+		yaffs_create_free_objs(dev,
+			yaffs_alloc_batch(allocator->n_obj_created,
+					  YAFFS_ALLOCATION_NOBJECTS,
+					  sizeof(struct yaffs_obj)));
 	if (!allocator->free_objs)
 		yaffs_create_free_objs(dev, YAFFS_ALLOCATION_NOBJECTS);
 
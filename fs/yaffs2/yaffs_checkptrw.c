@@ -46,9 +46,11 @@ static int yaffs_checkpt_erase(struct yaffs_dev *dev)
 			    erase_fn(dev,
 				     i - dev->block_offset /* realign */ )) {
 				bi->block_state = YAFFS_BLOCK_STATE_EMPTY;
+				spin_lock(&dev->alloc_lock);
 				dev->n_erased_blocks++;
 				dev->n_free_chunks +=
 				    dev->param.chunks_per_block;
+				spin_unlock(&dev->alloc_lock);
 			} else {
 				dev->param.bad_block_fn(dev, i);
 				bi->block_state = YAFFS_BLOCK_STATE_DEAD;
@@ -238,6 +240,7 @@ static int yaffs2_checkpt_flush_buffer(struct yaffs_dev *dev)
 	realigned_chunk = chunk - dev->chunk_offset;
 
 	dev->n_page_writes++;
+	dev->n_checkpt_writes++;
 
 	dev->param.write_chunk_tags_fn(dev, realigned_chunk,
 				       dev->checkpt_buffer, &tags);
@@ -386,9 +389,11 @@ int yaffs_checkpt_close(struct yaffs_dev *dev)
 		dev->checkpt_block_list = NULL;
 	}
 
+	spin_lock(&dev->alloc_lock);
 	dev->n_free_chunks -=
 	    dev->blocks_in_checkpt * dev->param.chunks_per_block;
 	dev->n_erased_blocks -= dev->blocks_in_checkpt;
+	spin_unlock(&dev->alloc_lock);
 
 	yaffs_trace(YAFFS_TRACE_CHECKPOINT,"checkpoint byte count %d",
 		dev->checkpt_byte_count);
@@ -424,7 +424,9 @@ static int yaffs_find_alloc_block(struct yaffs_dev *dev)
 			bi->block_state = YAFFS_BLOCK_STATE_ALLOCATING;
 			dev->seq_number++;
 			bi->seq_number = dev->seq_number;
+			spin_lock(&dev->alloc_lock);
 			dev->n_erased_blocks--;
+			spin_unlock(&dev->alloc_lock);
 			yaffs_trace(YAFFS_TRACE_ALLOCATE,
 			  "Allocated block %d, seq  %d, %d left" ,
 			   dev->alloc_block_finder, dev->seq_number,
@@ -472,7 +474,9 @@ static int yaffs_alloc_chunk(struct yaffs_dev *dev, int use_reserver,
 
 		dev->alloc_page++;
 
+		spin_lock(&dev->alloc_lock);
 		dev->n_free_chunks--;
+		spin_unlock(&dev->alloc_lock);
 
 		/* If the block is full set the state to full */
 		if (dev->alloc_page >= dev->param.chunks_per_block) {
@@ -1199,7 +1203,9 @@ static void yaffs_soft_del_chunk(struct yaffs_dev *dev, int chunk)
 	the_block = yaffs_get_block_info(dev, block_no);
 	if (the_block) {
 		the_block->soft_del_pages++;
+		spin_lock(&dev->alloc_lock);
 		dev->n_free_chunks++;
+		spin_unlock(&dev->alloc_lock);
 		yaffs2_update_oldest_dirty_seq(dev, block_no, the_block);
 	}
 }
@@ -1398,6 +1404,22 @@ static int yaffs_change_obj_name(struct yaffs_obj *obj,
  *   need a very intelligent search.
  */
 
+/* Dirty caches are counted so that the free space can be read cheaply. */
+static void yaffs_set_cache_dirty(struct yaffs_dev *dev,
+				  struct yaffs_cache *cache, int dirty)
+{
+	if (cache->dirty == dirty)
+		return;
+
+	spin_lock(&dev->alloc_lock);
+	cache->dirty = dirty;
+	if (dirty)
+		dev->n_dirty_caches++;
+	else
+		dev->n_dirty_caches--;
+	spin_unlock(&dev->alloc_lock);
+}
+
 static int yaffs_obj_cache_dirty(struct yaffs_obj *obj)
 {
 	struct yaffs_dev *dev = obj->my_dev;
@@ -1448,7 +1470,7 @@ static void yaffs_flush_file_cache(struct yaffs_obj *obj)
 						      cache->chunk_id,
 						      cache->data,
 						      cache->n_bytes, 1);
-				cache->dirty = 0;
+				yaffs_set_cache_dirty(dev, cache, 0);
 				cache->object = NULL;
 			}
 
@@ -1601,7 +1623,7 @@ static void yaffs_use_cache(struct yaffs_dev *dev, struct yaffs_cache *cache,
 		cache->last_use = dev->cache_last_use;
 
 		if (is_write)
-			cache->dirty = 1;
+			yaffs_set_cache_dirty(dev, cache, 1);
 	}
 }
 
@@ -2388,6 +2410,7 @@ void yaffs_block_became_dirty(struct yaffs_dev *dev, int block_no)
 	if (block_no == dev->gc_dirtiest) {
 		dev->gc_dirtiest = 0;
 		dev->gc_pages_in_use = 0;
+		dev->gc_score = 0;
 	}
 
 	if (!bi->needs_retiring) {
@@ -2418,7 +2441,9 @@ void yaffs_block_became_dirty(struct yaffs_dev *dev, int block_no)
 		/* Clean it up... */
 		bi->block_state = YAFFS_BLOCK_STATE_EMPTY;
 		bi->seq_number = 0;
+		spin_lock(&dev->alloc_lock);
 		dev->n_erased_blocks++;
+		spin_unlock(&dev->alloc_lock);
 		bi->pages_in_use = 0;
 		bi->soft_del_pages = 0;
 		bi->has_shrink_hdr = 0;
@@ -2430,7 +2455,9 @@ void yaffs_block_became_dirty(struct yaffs_dev *dev, int block_no)
 			"Erased block %d", block_no);
 	} else {
 		/* We lost a block of free space */
+		spin_lock(&dev->alloc_lock);
 		dev->n_free_chunks -= dev->param.chunks_per_block;
+		spin_unlock(&dev->alloc_lock);
 		yaffs_retire_block(dev, block_no);
 		yaffs_trace(YAFFS_TRACE_ERROR | YAFFS_TRACE_BAD_BLOCKS,
 			"**>> Block %d retired", block_no);
@@ -2558,7 +2585,9 @@ static int yaffs_gc_block(struct yaffs_dev *dev, int block, int whole_block)
 					 * which will increment free chunks.
 					 * We have to decrement free chunks so this works out properly.
 					 */
+					spin_lock(&dev->alloc_lock);
 					dev->n_free_chunks--;
+					spin_unlock(&dev->alloc_lock);
 					bi->soft_del_pages--;
 
 					object->n_data_chunks--;
@@ -2695,7 +2724,9 @@ static int yaffs_gc_block(struct yaffs_dev *dev, int block, int whole_block)
 					"yaffs: About to finally delete object %d",
 					object->obj_id);
 				yaffs_generic_obj_del(object);
-				object->my_dev->n_deleted_files--;
+				spin_lock(&dev->alloc_lock);
+				dev->n_deleted_files--;
+				spin_unlock(&dev->alloc_lock);
 			}
 
 		}
@@ -2715,6 +2746,33 @@ static int yaffs_gc_block(struct yaffs_dev *dev, int block, int whole_block)
 	return ret_val;
 }
 
+/*
+ * Cost-benefit score of collecting a block: the space freed, weighted by
+ * the age of the data, over the cost of reading the block and copying its
+ * live chunks.  Old (cold) data that has stayed put will probably stay
+ * put, so the space freed by collecting it lasts.  Recently written (hot)
+ * blocks are left to get dirtier on their own instead of having their
+ * live chunks copied again and again.
+ *
+ * The age is the number of blocks allocated since this one, from the
+ * yaffs2 sequence numbers, and is capped so the score fits in 32 bits.
+ */
+#define YAFFS_GC_MAX_AGE	0x7fff
+
+static unsigned yaffs_gc_score(struct yaffs_dev *dev,
+			       struct yaffs_block_info *bi, int pages_used)
+{
+	unsigned n_chunks = dev->param.chunks_per_block;
+	unsigned benefit = ((n_chunks - pages_used) << 16) /
+	    (n_chunks + pages_used);
+	unsigned age = dev->seq_number - bi->seq_number;
+
+	if (age >= YAFFS_GC_MAX_AGE)
+		age = YAFFS_GC_MAX_AGE - 1;
+
+	return benefit * (age + 1);
+}
+
 /*
  * FindBlockForgarbageCollection is used to select the dirtiest block (or close enough)
  * for garbage collection.
@@ -2771,6 +2829,11 @@ static unsigned yaffs_find_gc_block(struct yaffs_dev *dev,
 
 	if (!selected) {
 		int pages_used;
+		int better;
+		unsigned score = 0;
+		/* When space is short, only the space freed now matters */
+		int cost_benefit = dev->param.gc_cost_benefit &&
+		    dev->param.is_yaffs2 && !aggressive;
 		int n_blocks =
 		    dev->internal_end_block - dev->internal_start_block + 1;
 		if (aggressive) {
@@ -2812,13 +2875,27 @@ static unsigned yaffs_find_gc_block(struct yaffs_dev *dev,
 
 			pages_used = bi->pages_in_use - bi->soft_del_pages;
 
-			if (bi->block_state == YAFFS_BLOCK_STATE_FULL &&
-			    pages_used < dev->param.chunks_per_block &&
-			    (dev->gc_dirtiest < 1
-			     || pages_used < dev->gc_pages_in_use)
-			    && yaffs_block_ok_for_gc(dev, bi)) {
+			if (bi->block_state != YAFFS_BLOCK_STATE_FULL ||
+			    pages_used >= dev->param.chunks_per_block)
+				continue;
+
+			if (cost_benefit) {
+				/* Only blocks cheap enough to copy compete */
+				if (pages_used > threshold)
+					continue;
+				score = yaffs_gc_score(dev, bi, pages_used);
+				better = dev->gc_dirtiest < 1 ||
+				    dev->gc_pages_in_use > threshold ||
+				    score > dev->gc_score;
+			} else {
+				better = dev->gc_dirtiest < 1 ||
+				    pages_used < dev->gc_pages_in_use;
+			}
+
+			if (better && yaffs_block_ok_for_gc(dev, bi)) {
 				dev->gc_dirtiest = dev->gc_block_finder;
 				dev->gc_pages_in_use = pages_used;
+				dev->gc_score = score;
 			}
 		}
 
@@ -2859,6 +2936,7 @@ static unsigned yaffs_find_gc_block(struct yaffs_dev *dev,
 
 		dev->gc_dirtiest = 0;
 		dev->gc_pages_in_use = 0;
+		dev->gc_score = 0;
 		dev->gc_not_done = 0;
 		if (dev->refresh_skip > 0)
 			dev->refresh_skip--;
@@ -3056,7 +3134,9 @@ void yaffs_chunk_del(struct yaffs_dev *dev, int chunk_id, int mark_flash,
 	    bi->block_state == YAFFS_BLOCK_STATE_FULL ||
 	    bi->block_state == YAFFS_BLOCK_STATE_NEEDS_SCANNING ||
 	    bi->block_state == YAFFS_BLOCK_STATE_COLLECTING) {
+		spin_lock(&dev->alloc_lock);
 		dev->n_free_chunks++;
+		spin_unlock(&dev->alloc_lock);
 
 		yaffs_clear_chunk_bit(dev, block, page);
 
@@ -3583,7 +3663,7 @@ int yaffs_file_rd(struct yaffs_obj *in, u8 * buffer, loff_t offset, int n_bytes)
 					    yaffs_grab_chunk_cache(in->my_dev);
 					cache->object = in;
 					cache->chunk_id = chunk;
-					cache->dirty = 0;
+					yaffs_set_cache_dirty(dev, cache, 0);
 					cache->locked = 0;
 					yaffs_rd_data_obj(in, chunk,
 							  cache->data);
@@ -3709,7 +3789,7 @@ int yaffs_do_file_wr(struct yaffs_obj *in, const u8 * buffer, loff_t offset,
 					cache = yaffs_grab_chunk_cache(dev);
 					cache->object = in;
 					cache->chunk_id = chunk;
-					cache->dirty = 0;
+					yaffs_set_cache_dirty(dev, cache, 0);
 					cache->locked = 0;
 					yaffs_rd_data_obj(in, chunk,
 							  cache->data);
@@ -3740,7 +3820,8 @@ int yaffs_do_file_wr(struct yaffs_obj *in, const u8 * buffer, loff_t offset,
 						     cache->chunk_id,
 						     cache->data,
 						     cache->n_bytes, 1);
-						cache->dirty = 0;
+						yaffs_set_cache_dirty(dev,
+								      cache, 0);
 					}
 
 				} else {
@@ -3962,7 +4043,9 @@ static int yaffs_unlink_file_if_needed(struct yaffs_obj *in)
 			"yaffs: immediate deletion of file %d",
 			in->obj_id);
 		in->deleted = 1;
-		in->my_dev->n_deleted_files++;
+		spin_lock(&dev->alloc_lock);
+		dev->n_deleted_files++;
+		spin_unlock(&dev->alloc_lock);
 		if (dev->param.disable_soft_del || dev->param.is_yaffs2)
 			yaffs_resize_file(in, 0);
 		yaffs_soft_del_file(in);
@@ -3996,7 +4079,9 @@ int yaffs_del_file(struct yaffs_obj *in)
 		if (ret_val == YAFFS_OK && in->unlinked && !in->deleted) {
 			in->deleted = 1;
 			deleted = 1;
-			in->my_dev->n_deleted_files++;
+			spin_lock(&dev->alloc_lock);
+			dev->n_deleted_files++;
+			spin_unlock(&dev->alloc_lock);
 			yaffs_soft_del_file(in);
 		}
 		return deleted ? YAFFS_OK : YAFFS_FAIL;
@@ -4781,6 +4866,7 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 	dev->block_offset = 0;
 	dev->chunk_offset = 0;
 	dev->n_free_chunks = 0;
+	spin_lock_init(&dev->alloc_lock);
 
 	dev->gc_block = 0;
 
@@ -4920,6 +5006,7 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 	dev->buffered_block = -1;
 	dev->doing_buffered_block_rewrite = 0;
 	dev->n_deleted_files = 0;
+	dev->n_dirty_caches = 0;
 	dev->n_bg_deletions = 0;
 	dev->n_unlinked_files = 0;
 	dev->n_ecc_fixed = 0;
@@ -5052,6 +5139,7 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 	dev->n_page_writes = 0;
 	dev->n_erasures = 0;
 	dev->n_gc_copies = 0;
+	dev->n_checkpt_writes = 0;
 	dev->n_retired_writes = 0;
 
 	dev->n_retired_blocks = 0;
@@ -5127,38 +5215,58 @@ int yaffs_count_free_chunks(struct yaffs_dev *dev)
 	return n_free;
 }
 
-int yaffs_get_n_free_chunks(struct yaffs_dev *dev)
+static int yaffs_calc_n_free_chunks(struct yaffs_dev *dev,
+				    int blocks_for_checkpt)
 {
 	/* This is what we report to the outside world */
 
 	int n_free;
-	int n_dirty_caches;
-	int blocks_for_checkpt;
-	int i;
 
+	spin_lock(&dev->alloc_lock);
 	n_free = dev->n_free_chunks;
 	n_free += dev->n_deleted_files;
 
-	/* Now count the number of dirty chunks in the cache and subtract those */
-
-	for (n_dirty_caches = 0, i = 0; i < dev->param.n_caches; i++) {
-		if (dev->cache[i].dirty)
-			n_dirty_caches++;
-	}
-
-	n_free -= n_dirty_caches;
+	/* Now subtract the dirty chunks in the cache */
+	n_free -= dev->n_dirty_caches;
+	spin_unlock(&dev->alloc_lock);
 
 	n_free -=
 	    ((dev->param.n_reserved_blocks + 1) * dev->param.chunks_per_block);
 
-	/* Now we figure out how much to reserve for the checkpoint and report that... */
-	blocks_for_checkpt = yaffs_calc_checkpt_blocks_required(dev);
-
+	/* Now take off what we reserve for the checkpoint */
 	n_free -= (blocks_for_checkpt * dev->param.chunks_per_block);
 
 	if (n_free < 0)
 		n_free = 0;
 
 	return n_free;
+}
+
+/* Called with the gross lock held */
+int yaffs_get_n_free_chunks(struct yaffs_dev *dev)
+{
+	return yaffs_calc_n_free_chunks(dev,
+				yaffs_calc_checkpt_blocks_required(dev));
+}
+
+/*
+ * The same without the gross lock. The checkpoint size is only
+ * recalculated under the gross lock, so this uses the last value and
+ * returns -1 if there isn't one.
+ */
+int yaffs_peek_n_free_chunks(struct yaffs_dev *dev)
+{
+	int blocks_for_checkpt = 0;
+
+	if (yaffs2_checkpt_required(dev)) {
+		blocks_for_checkpt =
+		    ACCESS_ONCE(dev->checkpoint_blocks_required);
+		if (!blocks_for_checkpt)
+			return -1;
+		blocks_for_checkpt -= ACCESS_ONCE(dev->blocks_in_checkpt);
+		if (blocks_for_checkpt < 0)
+			blocks_for_checkpt = 0;
+	}
 
+	return yaffs_calc_n_free_chunks(dev, blocks_for_checkpt);
 }
@@ -518,6 +518,10 @@ struct yaffs_param {
 
 	int refresh_period;	/* How often we should check to do a block refresh */
 
+	int gc_cost_benefit;	/* yaffs2: pick gc blocks by free space and age,
+				 * rather than just free space.
+				 */
+
 	/* Checkpoint control. Can be set before or after initialisation */
 	u8 skip_checkpt_rd;
 	u8 skip_checkpt_wr;
@@ -547,6 +551,12 @@ struct yaffs_param {
 	int (*query_block_fn) (struct yaffs_dev * dev, int block_no,
 			       enum yaffs_block_state * state,
 			       u32 * seq_number);
+	/* Optional: read the tags of n_chunks consecutive chunks at once.
+	 * Used to speed up scanning.
+	 */
+	int (*read_multi_tags_fn) (struct yaffs_dev * dev,
+				   int nand_chunk, int n_chunks,
+				   struct yaffs_ext_tags * tags);
 #endif
 
 	/* The remove_obj_fn function must be supplied by OS flavours that
@@ -641,6 +651,15 @@ struct yaffs_dev {
 				 * Must be consistent with chunks_per_block.
 				 */
 
+	/*
+	 * Allocator and free space lock. Once mounted, n_erased_blocks,
+	 * n_free_chunks, n_deleted_files and n_dirty_caches only change
+	 * with both the gross lock and alloc_lock held, so they can be
+	 * read under either one. statfs and the background thread read
+	 * them without the gross lock.
+	 */
+	spinlock_t alloc_lock;
+
 	int n_erased_blocks;
 	int alloc_block;	/* Current block being allocated off */
 	u32 alloc_page;
@@ -667,6 +686,7 @@ struct yaffs_dev {
 	unsigned gc_block_finder;
 	unsigned gc_dirtiest;
 	unsigned gc_pages_in_use;
+	unsigned gc_score;	/* Cost-benefit score of gc_dirtiest */
 	unsigned gc_not_done;
 	unsigned gc_block;
 	unsigned gc_chunk;
@@ -685,6 +705,7 @@ struct yaffs_dev {
 	int doing_buffered_block_rewrite;
 
 	struct yaffs_cache *cache;
+	int n_dirty_caches;	/* Caches with dirty set */
 	int cache_last_use;
 
 	/* Stuff for background deletion and unlinked files. */
@@ -719,6 +740,7 @@ struct yaffs_dev {
 	u32 n_erasures;
 	u32 n_erase_failures;
 	u32 n_gc_copies;
+	u32 n_checkpt_writes;
 	u32 all_gcs;
 	u32 passive_gc_count;
 	u32 oldest_dirty_gc_count;
@@ -785,6 +807,7 @@ int yaffs_guts_initialise(struct yaffs_dev *dev);
 void yaffs_deinitialise(struct yaffs_dev *dev);
 
 int yaffs_get_n_free_chunks(struct yaffs_dev *dev);
+int yaffs_peek_n_free_chunks(struct yaffs_dev *dev);
 
 int yaffs_rename_obj(struct yaffs_obj *old_dir, const YCHAR * old_name,
 		     struct yaffs_obj *new_dir, const YCHAR * new_name);
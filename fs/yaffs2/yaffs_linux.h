@@ -25,6 +25,11 @@ struct yaffs_linux_context {
 	struct task_struct *bg_thread;	/* Background thread for this device */
 	int bg_running;
 	struct mutex gross_lock;	/* Gross locking mutex*/
+	atomic_t lock_waiters;	/* Tasks waiting for gross_lock */
+	unsigned lock_contended;	/* gross_lock takes that had to wait */
+	unsigned bg_gc_yields;	/* Background gc passes skipped for waiters */
+	unsigned mount_ms;	/* Time taken by yaffs_guts_initialise() */
+	int mount_from_checkpt;	/* Mounted without scanning */
 	u8 *spare_buffer;	/* For mtdif2 use. Don't know the size of the buffer
 				 * at compile time so we have to allocate it.
 				 */
@@ -165,6 +165,74 @@ int nandmtd2_read_chunk_tags(struct yaffs_dev *dev, int nand_chunk,
 		return YAFFS_FAIL;
 }
 
+/* Reads the tags of consecutive chunks with a single multi-page oob read.
+ * The MTD packs the available oob bytes of each page one after the other.
+ */
+int nandmtd2_read_multi_tags(struct yaffs_dev *dev, int nand_chunk,
+			     int n_chunks, struct yaffs_ext_tags *tags)
+{
+	struct mtd_info *mtd = yaffs_dev_to_mtd(dev);
+	struct mtd_oob_ops ops;
+	struct yaffs_packed_tags2 pt;
+	int oobavail = mtd->oobavail;
+	int retval;
+	int i;
+	u8 *oob;
+
+	loff_t addr = ((loff_t) nand_chunk) * dev->param.total_bytes_per_chunk;
+
+	int packed_tags_size =
+	    dev->param.no_tags_ecc ? sizeof(pt.t) : sizeof(pt);
+	void *packed_tags_ptr =
+	    dev->param.no_tags_ecc ? (void *)&pt.t : (void *)&pt;
+
+	yaffs_trace(YAFFS_TRACE_MTD,
+		"nandmtd2_read_multi_tags chunk %d n_chunks %d",
+		nand_chunk, n_chunks);
+
+	if (dev->param.inband_tags || oobavail < packed_tags_size)
+		return YAFFS_FAIL;
+
+	oob = kmalloc(n_chunks * oobavail, GFP_NOFS);
+	if (!oob)
+		return YAFFS_FAIL;
+
+	ops.mode = MTD_OOB_AUTO;
+	ops.ooblen = n_chunks * oobavail;
+	ops.len = 0;
+	ops.ooboffs = 0;
+	ops.datbuf = NULL;
+	ops.oobbuf = oob;
+	retval = mtd->read_oob(mtd, addr, &ops);
+
+	if (retval == 0 && ops.oobretlen == ops.ooblen) {
+		for (i = 0; i < n_chunks; i++) {
+			memcpy(packed_tags_ptr, oob + i * oobavail,
+			       packed_tags_size);
+			yaffs_unpack_tags2(&tags[i], &pt,
+					   !dev->param.no_tags_ecc);
+		}
+	}
+
+	kfree(oob);
+
+	/*
+	 * Some drivers only read the spare area of one page at a time.
+	 * Don't ask them again for the rest of this mount.
+	 */
+	if (retval == -EINVAL || retval == -EOPNOTSUPP) {
+		yaffs_trace(YAFFS_TRACE_MTD,
+			"nandmtd2_read_multi_tags not supported, error %d",
+			retval);
+		dev->param.read_multi_tags_fn = NULL;
+	}
+
+	if (retval == 0 && ops.oobretlen == ops.ooblen)
+		return YAFFS_OK;
+	else
+		return YAFFS_FAIL;
+}
+
 int nandmtd2_mark_block_bad(struct yaffs_dev *dev, int block_no)
 {
 	struct mtd_info *mtd = yaffs_dev_to_mtd(dev);
@@ -50,6 +50,37 @@ int yaffs_rd_chunk_tags_nand(struct yaffs_dev *dev, int nand_chunk,
 	return result;
 }
 
+/*
+ * Read the tags of all the chunks in a block with one driver call.
+ * Fails if the driver can't do that, or if any of the tags need ECC
+ * handling; the caller then reads the chunks one at a time.
+ */
+int yaffs_rd_block_tags_nand(struct yaffs_dev *dev, int block_no,
+			     struct yaffs_ext_tags *tags)
+{
+#ifdef CONFIG_YAFFS_YAFFS2
+	int n_chunks = dev->param.chunks_per_block;
+	int nand_chunk = block_no * n_chunks - dev->chunk_offset;
+	int i;
+
+	if (!dev->param.read_multi_tags_fn)
+		return YAFFS_FAIL;
+
+	if (dev->param.read_multi_tags_fn(dev, nand_chunk, n_chunks,
+					  tags) != YAFFS_OK)
+		return YAFFS_FAIL;
+
+	for (i = 0; i < n_chunks; i++)
+		if (tags[i].ecc_result > YAFFS_ECC_RESULT_NO_ERROR)
+			return YAFFS_FAIL;
+
+	dev->n_page_reads += n_chunks;
+	return YAFFS_OK;
+#else
+	return YAFFS_FAIL;
+#endif
+}
+
 int yaffs_wr_chunk_tags_nand(struct yaffs_dev *dev,
 			     int nand_chunk,
 			     const u8 * buffer, struct yaffs_ext_tags *tags)
@@ -53,6 +53,7 @@
 #include <linux/kthread.h>
 #include <linux/delay.h>
 #include <linux/freezer.h>
+#include <linux/ktime.h>
 
 #include <asm/div64.h>
 
@@ -96,6 +97,8 @@ unsigned int yaffs_wr_attempts = YAFFS_WR_ATTEMPTS;
 unsigned int yaffs_auto_checkpoint = 1;
 unsigned int yaffs_gc_control = 1;
 unsigned int yaffs_bg_enable = 1;
+unsigned int yaffs_bg_checkpoint;
+unsigned int yaffs_gc_cost_benefit = 1;
 
 /* Module Parameters */
 module_param(yaffs_trace_mask, uint, 0644);
@@ -103,6 +106,8 @@ module_param(yaffs_wr_attempts, uint, 0644);
 module_param(yaffs_auto_checkpoint, uint, 0644);
 module_param(yaffs_gc_control, uint, 0644);
 module_param(yaffs_bg_enable, uint, 0644);
+module_param(yaffs_bg_checkpoint, uint, 0644);
+module_param(yaffs_gc_cost_benefit, uint, 0644);
 
 
 #define yaffs_inode_to_obj_lv(iptr) ((iptr)->i_private)
@@ -122,8 +127,15 @@ static unsigned yaffs_gc_control_callback(struct yaffs_dev *dev)
 
 static void yaffs_gross_lock(struct yaffs_dev *dev)
 {
+	struct yaffs_linux_context *lc = yaffs_dev_to_lc(dev);
+
 	yaffs_trace(YAFFS_TRACE_LOCK, "yaffs locking %p", current);
-	mutex_lock(&(yaffs_dev_to_lc(dev)->gross_lock));
+	if (!mutex_trylock(&lc->gross_lock)) {
+		atomic_inc(&lc->lock_waiters);
+		mutex_lock(&lc->gross_lock);
+		atomic_dec(&lc->lock_waiters);
+		lc->lock_contended++;
+	}
 	yaffs_trace(YAFFS_TRACE_LOCK, "yaffs locked %p", current);
 }
 
@@ -133,6 +145,23 @@ static void yaffs_gross_unlock(struct yaffs_dev *dev)
 	mutex_unlock(&(yaffs_dev_to_lc(dev)->gross_lock));
 }
 
+/*
+ * Free space for statfs and yaffs_hold_space(). The counts are read under
+ * dev->alloc_lock; the gross lock is only needed when the checkpoint size
+ * has to be recalculated.
+ */
+static int yaffs_free_chunks(struct yaffs_dev *dev)
+{
+	int n_free_chunks = yaffs_peek_n_free_chunks(dev);
+
+	if (n_free_chunks < 0) {
+		yaffs_gross_lock(dev);
+		n_free_chunks = yaffs_get_n_free_chunks(dev);
+		yaffs_gross_unlock(dev);
+	}
+	return n_free_chunks;
+}
+
 static void yaffs_fill_inode_from_obj(struct inode *inode,
 				      struct yaffs_obj *obj);
 
@@ -1275,7 +1304,8 @@ static int yaffs_writepage(struct page *page, struct writeback_control *wbc)
 /* Space holding and freeing is done to ensure we have space available for 
  * write_begin/end.
  * For now we just assume few parallel writes and check against a small
- * number.
+ * number.  The free chunk count is read under dev->alloc_lock, so this
+ * doesn't need the gross lock.
  * Todo: need to do this with a counter to handle parallel reads better.
  */
 
@@ -1290,27 +1320,14 @@ static ssize_t yaffs_hold_space(struct file *f)
 
 	dev = obj->my_dev;
 
-	yaffs_gross_lock(dev);
-
-	n_free_chunks = yaffs_get_n_free_chunks(dev);
-
-	yaffs_gross_unlock(dev);
+	n_free_chunks = yaffs_free_chunks(dev);
 
 	return (n_free_chunks > 20) ? 1 : 0;
 }
 
 static void yaffs_release_space(struct file *f)
 {
-	struct yaffs_obj *obj;
-	struct yaffs_dev *dev;
-
-	obj = yaffs_dentry_to_obj(f->f_dentry);
-
-	dev = obj->my_dev;
-
-	yaffs_gross_lock(dev);
-
-	yaffs_gross_unlock(dev);
+	/* Nothing is reserved by yaffs_hold_space(), so nothing to release */
 }
 
 static int yaffs_write_begin(struct file *filp, struct address_space *mapping,
@@ -1461,8 +1478,6 @@ static int yaffs_statfs(struct dentry *dentry, struct kstatfs *buf)
 
 	yaffs_trace(YAFFS_TRACE_OS, "yaffs_statfs");
 
-	yaffs_gross_lock(dev);
-
 	buf->f_type = YAFFS_MAGIC;
 	buf->f_bsize = sb->s_blocksize;
 	buf->f_namelen = 255;
@@ -1482,7 +1497,7 @@ static int yaffs_statfs(struct dentry *dentry, struct kstatfs *buf)
 		do_div(bytes_in_dev, sb->s_blocksize);	/* bytes_in_dev becomes the number of blocks */
 		buf->f_blocks = bytes_in_dev;
 
-		bytes_free = ((uint64_t) (yaffs_get_n_free_chunks(dev))) *
+		bytes_free = ((uint64_t) (yaffs_free_chunks(dev))) *
 		    ((uint64_t) (dev->data_bytes_per_chunk));
 
 		do_div(bytes_free, sb->s_blocksize);
@@ -1496,7 +1511,7 @@ static int yaffs_statfs(struct dentry *dentry, struct kstatfs *buf)
 		    dev->param.chunks_per_block /
 		    (sb->s_blocksize / dev->data_bytes_per_chunk);
 		buf->f_bfree =
-		    yaffs_get_n_free_chunks(dev) /
+		    yaffs_free_chunks(dev) /
 		    (sb->s_blocksize / dev->data_bytes_per_chunk);
 	} else {
 		buf->f_blocks =
@@ -1505,7 +1520,7 @@ static int yaffs_statfs(struct dentry *dentry, struct kstatfs *buf)
 		    (dev->data_bytes_per_chunk / sb->s_blocksize);
 
 		buf->f_bfree =
-		    yaffs_get_n_free_chunks(dev) *
+		    yaffs_free_chunks(dev) *
 		    (dev->data_bytes_per_chunk / sb->s_blocksize);
 	}
 
@@ -1513,7 +1528,6 @@ static int yaffs_statfs(struct dentry *dentry, struct kstatfs *buf)
 	buf->f_ffree = 0;
 	buf->f_bavail = buf->f_bfree;
 
-	yaffs_gross_unlock(dev);
 	return 0;
 }
 
@@ -1545,23 +1559,29 @@ static void yaffs_flush_super(struct super_block *sb, int do_checkpoint)
 		yaffs_checkpoint_save(dev);
 }
 
+/* Called with or without the gross lock */
 static unsigned yaffs_bg_gc_urgency(struct yaffs_dev *dev)
 {
-	unsigned erased_chunks =
-	    dev->n_erased_blocks * dev->param.chunks_per_block;
+	unsigned erased_chunks;
+	unsigned n_free_chunks;
 	struct yaffs_linux_context *context = yaffs_dev_to_lc(dev);
 	unsigned scattered = 0;	/* Free chunks not in an erased block */
 
-	if (erased_chunks < dev->n_free_chunks)
-		scattered = (dev->n_free_chunks - erased_chunks);
+	spin_lock(&dev->alloc_lock);
+	erased_chunks = dev->n_erased_blocks * dev->param.chunks_per_block;
+	n_free_chunks = dev->n_free_chunks;
+	spin_unlock(&dev->alloc_lock);
+
+	if (erased_chunks < n_free_chunks)
+		scattered = (n_free_chunks - erased_chunks);
 
 	if (!context->bg_running)
 		return 0;
 	else if (scattered < (dev->param.chunks_per_block * 2))
 		return 0;
-	else if (erased_chunks > dev->n_free_chunks / 2)
+	else if (erased_chunks > n_free_chunks / 2)
 		return 0;
-	else if (erased_chunks > dev->n_free_chunks / 4)
+	else if (erased_chunks > n_free_chunks / 4)
 		return 1;
 	else
 		return 2;
@@ -1621,6 +1641,11 @@ static int yaffs_bg_thread_fn(void *data)
 	unsigned long now = jiffies;
 	unsigned long next_dir_update = now;
 	unsigned long next_gc = now;
+	unsigned long idle_since = now;
+	unsigned long checkpt_time = 0;
+	int checkpt_written = 0;
+	int checkpt_shift = 0;
+	u32 last_page_writes = dev->n_page_writes;
 	unsigned long expires;
 	unsigned int urgency;
 
@@ -1640,16 +1665,30 @@ static int yaffs_bg_thread_fn(void *data)
 		if (try_to_freeze())
 			continue;
 
-		yaffs_gross_lock(dev);
-
 		now = jiffies;
 
+		/*
+		 * Directory updates and gc are done under separate holds of
+		 * the lock, so foreground operations can get in between.
+		 */
 		if (time_after(now, next_dir_update) && yaffs_bg_enable) {
+			yaffs_gross_lock(dev);
 			yaffs_update_dirty_dirs(dev);
+			yaffs_gross_unlock(dev);
 			next_dir_update = now + HZ;
 		}
 
-		if (time_after(now, next_gc) && yaffs_bg_enable) {
+		if (time_after(now, next_gc) && yaffs_bg_enable &&
+		    atomic_read(&context->lock_waiters)) {
+			/*
+			 * The periodic gc pass gives way to foreground
+			 * operations waiting for the lock. Gc done while
+			 * allocating, ours included, is not affected.
+			 */
+			context->bg_gc_yields++;
+			next_gc = now + HZ / 10 + 1;
+		} else if (time_after(now, next_gc) && yaffs_bg_enable) {
+			yaffs_gross_lock(dev);
 			if (!dev->is_checkpointed) {
 				urgency = yaffs_bg_gc_urgency(dev);
 				gc_result = yaffs_bg_gc(dev, urgency);
@@ -1666,8 +1705,44 @@ static int yaffs_bg_thread_fn(void *data)
 				 */
 				next_gc = next_dir_update;
                         }
+			yaffs_gross_unlock(dev);
 		}
-		yaffs_gross_unlock(dev);
+
+		/*
+		 * Once nothing has been written for yaffs_bg_checkpoint
+		 * seconds, write a checkpoint so that the next mount doesn't
+		 * have to scan, even if we don't get a clean unmount.
+		 * Each checkpoint costs flash writes and is erased again by
+		 * the next write, so if writes keep coming back before the
+		 * idle time is up, the idle time doubles, up to 64 times.
+		 */
+		if (dev->n_page_writes != last_page_writes) {
+			last_page_writes = dev->n_page_writes;
+			idle_since = now;
+			if (checkpt_written) {
+				if (time_before(now, checkpt_time +
+					(yaffs_bg_checkpoint << checkpt_shift) *
+					HZ)) {
+					if (checkpt_shift < 6)
+						checkpt_shift++;
+				} else if (checkpt_shift > 0) {
+					checkpt_shift--;
+				}
+				checkpt_written = 0;
+			}
+		} else if (yaffs_bg_checkpoint && yaffs_bg_enable &&
+			   !dev->is_checkpointed &&
+			   time_after(now, idle_since +
+				(yaffs_bg_checkpoint << checkpt_shift) * HZ)) {
+			yaffs_trace(YAFFS_TRACE_BACKGROUND |
+				    YAFFS_TRACE_CHECKPOINT,
+				"yaffs_background: idle checkpoint");
+			yaffs_do_sync_fs(context->super, 1);
+			last_page_writes = dev->n_page_writes;
+			checkpt_time = now;
+			checkpt_written = 1;
+		}
+
 		expires = next_dir_update;
 		if (time_before(next_gc, expires))
 			expires = next_gc;
@@ -2016,6 +2091,7 @@ static struct super_block *yaffs_internal_read_super(int yaffs_version,
 	char devname_buf[BDEVNAME_SIZE + 1];
 	struct mtd_info *mtd;
 	int err;
+	ktime_t mount_start;
 	char *data_str = (char *)data;
 	struct yaffs_linux_context *context = NULL;
 	struct yaffs_param *param;
@@ -2248,6 +2324,8 @@ static struct super_block *yaffs_internal_read_super(int yaffs_version,
 	param->refresh_period = 500;
 #endif
 
+	param->gc_cost_benefit = yaffs_gc_cost_benefit;
+
 #ifdef CONFIG_YAFFS_ALWAYS_CHECK_CHUNK_ERASED
 	param->always_check_erased = 1;
 #endif
@@ -2259,6 +2337,7 @@ static struct super_block *yaffs_internal_read_super(int yaffs_version,
 	if (yaffs_version == 2) {
 		param->write_chunk_tags_fn = nandmtd2_write_chunk_tags;
 		param->read_chunk_tags_fn = nandmtd2_read_chunk_tags;
+		param->read_multi_tags_fn = nandmtd2_read_multi_tags;
 		param->bad_block_fn = nandmtd2_mark_block_bad;
 		param->query_block_fn = nandmtd2_query_block;
 		yaffs_dev_to_lc(dev)->spare_buffer = 
@@ -2320,14 +2399,22 @@ static struct super_block *yaffs_internal_read_super(int yaffs_version,
 	param->remove_obj_fn = yaffs_remove_obj_callback;
 
 	mutex_init(&(yaffs_dev_to_lc(dev)->gross_lock));
+	atomic_set(&(yaffs_dev_to_lc(dev)->lock_waiters), 0);
 
 	yaffs_gross_lock(dev);
 
+	mount_start = ktime_get();
 	err = yaffs_guts_initialise(dev);
+	context->mount_ms = ktime_to_ms(ktime_sub(ktime_get(), mount_start));
+	context->mount_from_checkpt = dev->is_checkpointed;
 
 	yaffs_trace(YAFFS_TRACE_OS,
 		"yaffs_read_super: guts initialised %s",
 		(err == YAFFS_OK) ? "OK" : "FAILED");
+	yaffs_trace(YAFFS_TRACE_MOUNT,
+		"yaffs: mounting %s took %u ms, %s",
+		param->name, context->mount_ms,
+		context->mount_from_checkpt ? "from checkpoint" : "scanned");
 
 	if (err == YAFFS_OK)
 		yaffs_bg_start(dev);
@@ -2435,6 +2522,8 @@ static char *yaffs_dump_dev_part0(char *buf, struct yaffs_dev *dev)
 			param->disable_lazy_load);
 	buf += sprintf(buf, "refresh_period........ %d\n",
 			param->refresh_period);
+	buf += sprintf(buf, "gc_cost_benefit....... %d\n",
+			param->gc_cost_benefit);
 	buf += sprintf(buf, "n_caches.............. %d\n", param->n_caches);
 	buf += sprintf(buf, "n_reserved_blocks..... %d\n",
 			param->n_reserved_blocks);
@@ -2446,6 +2535,9 @@ static char *yaffs_dump_dev_part0(char *buf, struct yaffs_dev *dev)
 
 static char *yaffs_dump_dev_part1(char *buf, struct yaffs_dev *dev)
 {
+	u32 host_writes;
+	u32 wa;
+
 	buf +=
 	    sprintf(buf, "data_bytes_per_chunk.. %d\n",
 		    dev->data_bytes_per_chunk);
@@ -2464,6 +2556,19 @@ static char *yaffs_dump_dev_part1(char *buf, struct yaffs_dev *dev)
 	buf += sprintf(buf, "n_page_reads.......... %u\n", dev->n_page_reads);
 	buf += sprintf(buf, "n_erasures............ %u\n", dev->n_erasures);
 	buf += sprintf(buf, "n_gc_copies........... %u\n", dev->n_gc_copies);
+	buf += sprintf(buf, "n_checkpt_writes...... %u\n",
+			dev->n_checkpt_writes);
+
+	/* Chunks written to flash per chunk written on behalf of the user */
+	host_writes = dev->n_gc_copies + dev->n_checkpt_writes;
+	if (dev->n_page_writes > host_writes) {
+		host_writes = dev->n_page_writes - host_writes;
+		wa = div_u64((u64)dev->n_page_writes * 100, host_writes);
+	} else {
+		wa = 0;
+	}
+	buf += sprintf(buf, "write_amplification... %u.%02u\n",
+			wa / 100, wa % 100);
 	buf += sprintf(buf, "all_gcs............... %u\n", dev->all_gcs);
 	buf +=
 	    sprintf(buf, "passive_gc_count...... %u\n", dev->passive_gc_count);
@@ -2490,6 +2595,14 @@ static char *yaffs_dump_dev_part1(char *buf, struct yaffs_dev *dev)
 	    sprintf(buf, "n_unlinked_files...... %u\n", dev->n_unlinked_files);
 	buf += sprintf(buf, "refresh_count......... %u\n", dev->refresh_count);
 	buf += sprintf(buf, "n_bg_deletions........ %u\n", dev->n_bg_deletions);
+	buf += sprintf(buf, "lock_contended........ %u\n",
+			yaffs_dev_to_lc(dev)->lock_contended);
+	buf += sprintf(buf, "bg_gc_yields.......... %u\n",
+			yaffs_dev_to_lc(dev)->bg_gc_yields);
+	buf += sprintf(buf, "mount_ms.............. %u\n",
+			yaffs_dev_to_lc(dev)->mount_ms);
+	buf += sprintf(buf, "mount_from_checkpt.... %d\n",
+			yaffs_dev_to_lc(dev)->mount_from_checkpt);
 
 	return buf;
 }
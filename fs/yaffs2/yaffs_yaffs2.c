@@ -987,6 +987,10 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 	struct yaffs_block_index *block_index = NULL;
 	int alt_block_index = 0;
 
+	struct yaffs_ext_tags *block_tags;
+	int have_block_tags;
+	int n_block_reads = 0;
+
 	yaffs_trace(YAFFS_TRACE_SCAN,
 		"yaffs2_scan_backwards starts  intstartblk %d intendblk %d...",
 		dev->internal_start_block, dev->internal_end_block);
@@ -1013,6 +1017,12 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 
 	chunk_data = yaffs_get_temp_buffer(dev, __LINE__);
 
+	/* Tags of a whole block, if the driver can read them in one go */
+	block_tags = NULL;
+	if (dev->param.read_multi_tags_fn)
+		block_tags = kmalloc(dev->param.chunks_per_block *
+				     sizeof(struct yaffs_ext_tags), GFP_NOFS);
+
 	/* Scan all the blocks to determine their state */
 	bi = dev->block_info;
 	for (blk = dev->internal_start_block; blk <= dev->internal_end_block;
@@ -1102,6 +1112,12 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 
 		deleted = 0;
 
+		have_block_tags = block_tags &&
+		    state == YAFFS_BLOCK_STATE_NEEDS_SCANNING &&
+		    yaffs_rd_block_tags_nand(dev, blk, block_tags) == YAFFS_OK;
+		if (have_block_tags)
+			n_block_reads++;
+
 		/* For each chunk in each block that needs scanning.... */
 		found_chunks = 0;
 		for (c = dev->param.chunks_per_block - 1;
@@ -1114,8 +1130,11 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 
 			chunk = blk * dev->param.chunks_per_block + c;
 
-			result = yaffs_rd_chunk_tags_nand(dev, chunk, NULL,
-							  &tags);
+			if (have_block_tags)
+				tags = block_tags[c];
+			else
+				result = yaffs_rd_chunk_tags_nand(dev, chunk,
+								  NULL, &tags);
 
 			/* Let's have a good look at this chunk... */
 
@@ -1580,6 +1599,12 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 	else
 		kfree(block_index);
 
+	kfree(block_tags);
+
+	yaffs_trace(YAFFS_TRACE_SCAN | YAFFS_TRACE_MOUNT,
+		"yaffs2_scan_backwards: %d blocks scanned, %d with one tags read",
+		n_to_scan, n_block_reads);
+
 	/* Ok, we've done all the scanning.
 	 * Fix up the hard link chains.
 	 * We should now have scanned all the objects, now it's time to add these
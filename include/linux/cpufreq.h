@@ -360,6 +360,18 @@ extern struct cpufreq_governor cpufreq_gov_interactive;
 #define CPUFREQ_DEFAULT_GOVERNOR	(&cpufreq_gov_interactive)
 #endif
 
+/*
+ * Raise CPU speed ahead of an expected burst of work. With the governor
+ * built as a module only other modules can reach it; built-in callers
+ * get the stub.
+ */
+#if defined(CONFIG_CPU_FREQ_GOV_INTERACTIVE) || \
+	(defined(CONFIG_CPU_FREQ_GOV_INTERACTIVE_MODULE) && defined(MODULE))
+extern void cpufreq_interactive_boost(unsigned int duration_us);
+#else
+static inline void cpufreq_interactive_boost(unsigned int duration_us) {}
+#endif
+
 
 /*********************************************************************
  *                     FREQUENCY TABLE HELPERS                       *
@@ -29,6 +29,8 @@
  * the suspend handlers have already been called without a matching call to the
  * resume handlers, the suspend handler will be called directly from
  * register_early_suspend. This direct call can violate the normal level order.
+ * Handlers at the same level may be called concurrently with each other, so
+ * a handler that depends on another one must use a different level.
  */
 enum {
 	EARLY_SUSPEND_LEVEL_BLANK_SCREEN = 50,
@@ -41,6 +43,11 @@ struct early_suspend {
 	int level;
 	void (*suspend)(struct early_suspend *h);
 	void (*resume)(struct early_suspend *h);
+	/* Time taken by the last and slowest calls, in usecs */
+	unsigned int suspend_us;
+	unsigned int suspend_max_us;
+	unsigned int resume_us;
+	unsigned int resume_max_us;
 #endif
 };
 
@@ -6,6 +6,7 @@
 #include <linux/init.h>
 #include <linux/pm.h>
 #include <linux/mm.h>
+#include <linux/ktime.h>
 #include <asm/errno.h>
 
 #if defined(CONFIG_PM_SLEEP) && defined(CONFIG_VT) && defined(CONFIG_VT_CONSOLE)
@@ -297,6 +298,47 @@ static inline int unregister_pm_notifier(struct notifier_block *nb)
 static inline bool pm_wakeup_pending(void) { return false; }
 #endif /* !CONFIG_PM_SLEEP */
 
+enum suspend_profile_kind {
+	SUSPEND_PROFILE_SUSPEND,
+	SUSPEND_PROFILE_EARLY_SUSPEND,
+	SUSPEND_PROFILE_LATE_RESUME,
+};
+
+enum suspend_profile_phase {
+	SUSPEND_PHASE_SYNC,
+	SUSPEND_PHASE_FREEZE,
+	SUSPEND_PHASE_SUSPEND_DEVICES,
+	SUSPEND_PHASE_SUSPEND_NOIRQ,
+	SUSPEND_PHASE_RESUME_NOIRQ,
+	SUSPEND_PHASE_RESUME_DEVICES,
+	SUSPEND_PHASE_THAW,
+	SUSPEND_PHASE_HANDLERS,
+	SUSPEND_PHASE_COUNT,
+};
+
+#ifdef CONFIG_PM_SUSPEND_PROFILE
+extern void suspend_profile_begin(enum suspend_profile_kind kind);
+extern void suspend_profile_end(int error);
+extern bool suspend_profile_active(void);
+extern ktime_t suspend_profile_phase_start(enum suspend_profile_phase phase);
+extern void suspend_profile_phase_end(enum suspend_profile_phase phase,
+				      ktime_t start);
+extern void suspend_profile_call(const char *name, void *func, ktime_t start);
+#else /* !CONFIG_PM_SUSPEND_PROFILE */
+static inline void suspend_profile_begin(enum suspend_profile_kind kind) {}
+static inline void suspend_profile_end(int error) {}
+static inline bool suspend_profile_active(void) { return false; }
+static inline ktime_t suspend_profile_phase_start(
+	enum suspend_profile_phase phase)
+{
+	return ktime_set(0, 0);
+}
+static inline void suspend_profile_phase_end(enum suspend_profile_phase phase,
+					     ktime_t start) {}
+static inline void suspend_profile_call(const char *name, void *func,
+					ktime_t start) {}
+#endif /* !CONFIG_PM_SUSPEND_PROFILE */
+
 extern struct mutex pm_mutex;
 
 #ifndef CONFIG_HIBERNATE_CALLBACKS
@@ -18,6 +18,7 @@
 
 #include <linux/list.h>
 #include <linux/ktime.h>
+#include <linux/timerqueue.h>
 
 /* A wake_lock prevents the system from entering suspend or other low power
  * states when active. If the type is set to WAKE_LOCK_SUSPEND, the wake_lock
@@ -38,11 +39,14 @@ struct wake_lock {
 	int                 flags;
 	const char         *name;
 	unsigned long       expires;
+	struct timerqueue_node expire_node;
 #ifdef CONFIG_WAKELOCK_STAT
 	struct {
 		int             count;
 		int             expire_count;
 		int             wakeup_count;
+		int             acquire_count;
+		int             contended_count;
 		ktime_t         total_time;
 		ktime_t         prevent_suspend_time;
 		ktime_t         max_time;
@@ -0,0 +1,155 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM cpufreq_interactive
+
+#if !defined(_TRACE_CPUFREQ_INTERACTIVE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_CPUFREQ_INTERACTIVE_H
+
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(set,
+
+	TP_PROTO(u32 cpu_id, unsigned long targfreq,
+		 unsigned long actualfreq),
+
+	TP_ARGS(cpu_id, targfreq, actualfreq),
+
+	TP_STRUCT__entry(
+		__field(	u32,		cpu_id		)
+		__field(	unsigned long,	targfreq	)
+		__field(	unsigned long,	actualfreq	)
+	),
+
+	TP_fast_assign(
+		__entry->cpu_id = cpu_id;
+		__entry->targfreq = targfreq;
+		__entry->actualfreq = actualfreq;
+	),
+
+	TP_printk("cpu=%u targ=%lu actual=%lu",
+		  __entry->cpu_id, __entry->targfreq,
+		  __entry->actualfreq)
+);
+
+/* up_task changed the speed of a CPU */
+DEFINE_EVENT(set, cpufreq_interactive_up,
+
+	TP_PROTO(u32 cpu_id, unsigned long targfreq,
+		 unsigned long actualfreq),
+
+	TP_ARGS(cpu_id, targfreq, actualfreq)
+);
+
+/* The down work changed the speed of a CPU */
+DEFINE_EVENT(set, cpufreq_interactive_down,
+
+	TP_PROTO(u32 cpu_id, unsigned long targfreq,
+		 unsigned long actualfreq),
+
+	TP_ARGS(cpu_id, targfreq, actualfreq)
+);
+
+DECLARE_EVENT_CLASS(loadeval,
+
+	TP_PROTO(unsigned long cpu_id, unsigned long load,
+		 unsigned long load_since_change,
+		 unsigned long curtarg, unsigned long newtarg),
+
+	TP_ARGS(cpu_id, load, load_since_change, curtarg, newtarg),
+
+	TP_STRUCT__entry(
+		__field(	unsigned long,	cpu_id		)
+		__field(	unsigned long,	load		)
+		__field(	unsigned long,	load_since_change )
+		__field(	unsigned long,	curtarg		)
+		__field(	unsigned long,	newtarg		)
+	),
+
+	TP_fast_assign(
+		__entry->cpu_id = cpu_id;
+		__entry->load = load;
+		__entry->load_since_change = load_since_change;
+		__entry->curtarg = curtarg;
+		__entry->newtarg = newtarg;
+	),
+
+	TP_printk("cpu=%lu load=%lu since_change=%lu cur=%lu targ=%lu",
+		  __entry->cpu_id, __entry->load, __entry->load_since_change,
+		  __entry->curtarg, __entry->newtarg)
+);
+
+/* A sample produced a higher target; the CPU is queued to up_task */
+DEFINE_EVENT(loadeval, cpufreq_interactive_target,
+	TP_PROTO(unsigned long cpu_id, unsigned long load,
+		 unsigned long load_since_change,
+		 unsigned long curtarg, unsigned long newtarg),
+	TP_ARGS(cpu_id, load, load_since_change, curtarg, newtarg)
+);
+
+/* A sample produced a lower target; the CPU is queued to the down work */
+DEFINE_EVENT(loadeval, cpufreq_interactive_rampdown,
+	TP_PROTO(unsigned long cpu_id, unsigned long load,
+		 unsigned long load_since_change,
+		 unsigned long curtarg, unsigned long newtarg),
+	TP_ARGS(cpu_id, load, load_since_change, curtarg, newtarg)
+);
+
+/* A sample produced the current target */
+DEFINE_EVENT(loadeval, cpufreq_interactive_already,
+	TP_PROTO(unsigned long cpu_id, unsigned long load,
+		 unsigned long load_since_change,
+		 unsigned long curtarg, unsigned long newtarg),
+	TP_ARGS(cpu_id, load, load_since_change, curtarg, newtarg)
+);
+
+/* Ramp down held off by min_sample_time or an active boost */
+DEFINE_EVENT(loadeval, cpufreq_interactive_notyet,
+	TP_PROTO(unsigned long cpu_id, unsigned long load,
+		 unsigned long load_since_change,
+		 unsigned long curtarg, unsigned long newtarg),
+	TP_ARGS(cpu_id, load, load_since_change, curtarg, newtarg)
+);
+
+TRACE_EVENT(cpufreq_interactive_predict,
+
+	TP_PROTO(unsigned long cpu_id, unsigned long load,
+		 unsigned long predicted),
+
+	TP_ARGS(cpu_id, load, predicted),
+
+	TP_STRUCT__entry(
+		__field(	unsigned long,	cpu_id		)
+		__field(	unsigned long,	load		)
+		__field(	unsigned long,	predicted	)
+	),
+
+	TP_fast_assign(
+		__entry->cpu_id = cpu_id;
+		__entry->load = load;
+		__entry->predicted = predicted;
+	),
+
+	TP_printk("cpu=%lu load=%lu predicted=%lu",
+		  __entry->cpu_id, __entry->load, __entry->predicted)
+);
+
+TRACE_EVENT(cpufreq_interactive_boost,
+
+	TP_PROTO(unsigned int duration_us),
+
+	TP_ARGS(duration_us),
+
+	TP_STRUCT__entry(
+		__field(	unsigned int,	duration_us	)
+	),
+
+	TP_fast_assign(
+		__entry->duration_us = duration_us;
+	),
+
+	TP_printk("duration=%uus", __entry->duration_us)
+);
+
+#endif /* _TRACE_CPUFREQ_INTERACTIVE_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
@@ -234,6 +234,52 @@ DEFINE_EVENT(power_domain, power_domain_target,
 
 	TP_ARGS(name, state, cpu_id)
 );
+
+/*
+ * Time spent in one phase of suspend or resume, and in one device
+ * callback (name) or early suspend handler (func) of that phase.
+ */
+TRACE_EVENT(suspend_profile_phase,
+
+	TP_PROTO(const char *phase, unsigned int usecs),
+
+	TP_ARGS(phase, usecs),
+
+	TP_STRUCT__entry(
+		__string(       phase,          phase           )
+		__field(        u32,            usecs           )
+	),
+
+	TP_fast_assign(
+		__assign_str(phase, phase);
+		__entry->usecs = usecs;
+	),
+
+	TP_printk("phase=%s usecs=%lu", __get_str(phase),
+		  (unsigned long)__entry->usecs)
+);
+
+TRACE_EVENT(suspend_profile_call,
+
+	TP_PROTO(const char *name, void *func, unsigned int usecs),
+
+	TP_ARGS(name, func, usecs),
+
+	TP_STRUCT__entry(
+		__string(       name,           name ? name : "" )
+		__field(        void *,         func            )
+		__field(        u32,            usecs           )
+	),
+
+	TP_fast_assign(
+		__assign_str(name, name ? name : "");
+		__entry->func = func;
+		__entry->usecs = usecs;
+	),
+
+	TP_printk("name=%s func=%pf usecs=%lu", __get_str(name),
+		  __entry->func, (unsigned long)__entry->usecs)
+);
 #endif /* _TRACE_POWER_H */
 
 /* This part must be outside protection */
@@ -212,6 +212,8 @@ repeat:
 
 	write_unlock_irq(&tasklist_lock);
 	release_thread(p);
+	/* listeners drop p before the RCU grace period starts */
+	oom_adj_notify(p);
 	call_rcu(&p->rcu, delayed_put_task_struct);
 
 	p = leader;
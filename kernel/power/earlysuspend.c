@@ -13,10 +13,13 @@
  *
  */
 
+#include <linux/async.h>
+#include <linux/debugfs.h>
 #include <linux/earlysuspend.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
 #include <linux/rtc.h>
+#include <linux/seq_file.h>
 #include <linux/syscalls.h> /* sys_sync */
 #include <linux/wakelock.h>
 #include <linux/workqueue.h>
@@ -30,6 +33,15 @@ enum {
 static int debug_mask = DEBUG_USER_STATE;
 module_param_named(debug_mask, debug_mask, int, S_IRUGO | S_IWUSR | S_IWGRP);
 
+/*
+ * Run the handlers of one level concurrently.  Levels are still
+ * processed one after another.
+ */
+static int async_handlers = 1;
+module_param(async_handlers, int, S_IRUGO | S_IWUSR | S_IWGRP);
+
+static LIST_HEAD(early_suspend_domain);
+
 static DEFINE_MUTEX(early_suspend_lock);
 static LIST_HEAD(early_suspend_handlers);
 static void early_suspend(struct work_struct *work);
@@ -70,11 +82,68 @@ void unregister_early_suspend(struct early_suspend *handler)
 }
 EXPORT_SYMBOL(unregister_early_suspend);
 
+static void early_suspend_account(void *func, ktime_t start,
+				  unsigned int *last, unsigned int *max,
+				  const char *what)
+{
+	s64 us = ktime_to_us(ktime_sub(ktime_get(), start));
+
+	*last = min_t(s64, us, UINT_MAX);
+	if (*last > *max)
+		*max = *last;
+
+	suspend_profile_call(NULL, func, start);
+
+	if (debug_mask & DEBUG_SUSPEND)
+		pr_info("%s: %pf took %u us\n", what, func, *last);
+}
+
+static void early_suspend_call(void *data, async_cookie_t cookie)
+{
+	struct early_suspend *handler = data;
+	ktime_t start = ktime_get();
+
+	handler->suspend(handler);
+	early_suspend_account(handler->suspend, start, &handler->suspend_us,
+			      &handler->suspend_max_us, "early_suspend");
+}
+
+static void late_resume_call(void *data, async_cookie_t cookie)
+{
+	struct early_suspend *handler = data;
+	ktime_t start = ktime_get();
+
+	handler->resume(handler);
+	early_suspend_account(handler->resume, start, &handler->resume_us,
+			      &handler->resume_max_us, "late_resume");
+}
+
+/*
+ * Queue one handler behind those already started.  Handlers of the
+ * previous level have to finish before the first one of a new level
+ * starts.  Called with early_suspend_lock held.
+ */
+static void early_suspend_queue(async_func_ptr *func,
+				struct early_suspend *handler, int *level)
+{
+	if (!async_handlers || handler->level != *level) {
+		async_synchronize_full_domain(&early_suspend_domain);
+		*level = handler->level;
+	}
+
+	if (async_handlers)
+		async_schedule_domain(func, handler, &early_suspend_domain);
+	else
+		func(handler, 0);
+}
+
 static void early_suspend(struct work_struct *work)
 {
 	struct early_suspend *pos;
 	unsigned long irqflags;
 	int abort = 0;
+	int level = INT_MIN;
+	ktime_t phasetime;
 
 	mutex_lock(&early_suspend_lock);
 	spin_lock_irqsave(&state_lock, irqflags);
@@ -93,10 +162,15 @@ static void early_suspend(struct work_struct *work)
 
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("early_suspend: call handlers\n");
+	suspend_profile_begin(SUSPEND_PROFILE_EARLY_SUSPEND);
+	phasetime = suspend_profile_phase_start(SUSPEND_PHASE_HANDLERS);
 	list_for_each_entry(pos, &early_suspend_handlers, link) {
 		if (pos->suspend != NULL)
-			pos->suspend(pos);
+			early_suspend_queue(early_suspend_call, pos, &level);
 	}
+	async_synchronize_full_domain(&early_suspend_domain);
+	suspend_profile_phase_end(SUSPEND_PHASE_HANDLERS, phasetime);
+	suspend_profile_end(0);
 	mutex_unlock(&early_suspend_lock);
 
 	if (debug_mask & DEBUG_SUSPEND)
@@ -115,6 +189,8 @@ static void late_resume(struct work_struct *work)
 	struct early_suspend *pos;
 	unsigned long irqflags;
 	int abort = 0;
+	int level = INT_MIN;
+	ktime_t phasetime;
 
 	mutex_lock(&early_suspend_lock);
 	spin_lock_irqsave(&state_lock, irqflags);
@@ -131,9 +207,14 @@ static void late_resume(struct work_struct *work)
 	}
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("late_resume: call handlers\n");
+	suspend_profile_begin(SUSPEND_PROFILE_LATE_RESUME);
+	phasetime = suspend_profile_phase_start(SUSPEND_PHASE_HANDLERS);
 	list_for_each_entry_reverse(pos, &early_suspend_handlers, link)
 		if (pos->resume != NULL)
-			pos->resume(pos);
+			early_suspend_queue(late_resume_call, pos, &level);
+	async_synchronize_full_domain(&early_suspend_domain);
+	suspend_profile_phase_end(SUSPEND_PHASE_HANDLERS, phasetime);
+	suspend_profile_end(0);
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("late_resume: done\n");
 abort:
@@ -176,3 +257,43 @@ suspend_state_t get_suspend_state(void)
 {
 	return requested_suspend_state;
 }
+
+#ifdef CONFIG_DEBUG_FS
+static int early_suspend_stats_show(struct seq_file *m, void *unused)
+{
+	struct early_suspend *pos;
+
+	seq_puts(m, "level\tsuspend_us\tsuspend_max_us\t"
+		 "resume_us\tresume_max_us\thandler\n");
+
+	mutex_lock(&early_suspend_lock);
+	list_for_each_entry(pos, &early_suspend_handlers, link)
+		seq_printf(m, "%d\t%u\t%u\t%u\t%u\t%pf/%pf\n", pos->level,
+			   pos->suspend_us, pos->suspend_max_us,
+			   pos->resume_us, pos->resume_max_us,
+			   pos->suspend, pos->resume);
+	mutex_unlock(&early_suspend_lock);
+
+	return 0;
+}
+
+static int early_suspend_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, early_suspend_stats_show, NULL);
+}
+
+static const struct file_operations early_suspend_stats_fops = {
+	.open		= early_suspend_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init early_suspend_debugfs_init(void)
+{
+	debugfs_create_file("early_suspend_stats", S_IRUGO, NULL, NULL,
+			    &early_suspend_stats_fops);
+	return 0;
+}
+late_initcall(early_suspend_debugfs_init);
+#endif
@@ -150,6 +150,7 @@ static int try_to_freeze_tasks(bool sig_only)
  */
 int freeze_processes(void)
 {
+	ktime_t phasetime = suspend_profile_phase_start(SUSPEND_PHASE_FREEZE);
 	int error;
 
 	printk("Freezing user space processes ... ");
@@ -168,6 +169,7 @@ int freeze_processes(void)
  Exit:
 	BUG_ON(in_atomic());
 	printk("\n");
+	suspend_profile_phase_end(SUSPEND_PHASE_FREEZE, phasetime);
 
 	return error;
 }
@@ -194,6 +196,8 @@ static void thaw_tasks(bool nosig_only)
 
 void thaw_processes(void)
 {
+	ktime_t phasetime = suspend_profile_phase_start(SUSPEND_PHASE_THAW);
+
 	oom_killer_enable();
 
 	printk("Restarting tasks ... ");
@@ -202,5 +206,6 @@ void thaw_processes(void)
 	thaw_tasks(false);
 	schedule();
 	printk("done.\n");
+	suspend_profile_phase_end(SUSPEND_PHASE_THAW, phasetime);
 }
 
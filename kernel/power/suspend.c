@@ -274,6 +274,7 @@ static void suspend_finish(void)
  */
 int enter_state(suspend_state_t state)
 {
+	ktime_t phasetime;
 	int error;
 
 	if (!valid_state(state))
@@ -282,8 +283,12 @@ int enter_state(suspend_state_t state)
 	if (!mutex_trylock(&pm_mutex))
 		return -EBUSY;
 
+	suspend_profile_begin(SUSPEND_PROFILE_SUSPEND);
+
 	printk(KERN_INFO "PM: Syncing filesystems ... ");
+	phasetime = suspend_profile_phase_start(SUSPEND_PHASE_SYNC);
 	sys_sync();
+	suspend_profile_phase_end(SUSPEND_PHASE_SYNC, phasetime);
 	printk("done.\n");
 
 	pr_debug("PM: Preparing system for %s sleep\n", pm_states[state]);
@@ -303,6 +308,7 @@ int enter_state(suspend_state_t state)
 	pr_debug("PM: Finishing wakeup.\n");
 	suspend_finish();
  Unlock:
+	suspend_profile_end(error);
 	mutex_unlock(&pm_mutex);
 	return error;
 }
@@ -0,0 +1,275 @@
+/*
+ * kernel/power/suspend_profile.c - Where does suspend and resume time go?
+ *
+ * Records, for each suspend cycle and each run of the early suspend or
+ * late resume handlers, the time spent in every phase (sync, freezer,
+ * device suspend and resume, ...) and the slowest individual device
+ * callbacks and handlers.  The last SUSPEND_PROFILE_HISTORY records are
+ * kept and listed in debugfs suspend_profile; every phase and callback
+ * is also reported through the suspend_profile_* trace events.
+ *
+ * This file is released under the GPLv2.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/seq_file.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/suspend.h>
+
+#include <trace/events/power.h>
+
+#define SUSPEND_PROFILE_HISTORY	16
+#define SUSPEND_PROFILE_SLOWEST	8
+
+struct suspend_profile_call {
+	char name[20];
+	void *func;
+	u8 phase;
+	u32 usecs;
+};
+
+struct suspend_profile_record {
+	unsigned int seq;
+	enum suspend_profile_kind kind;
+	s64 start_ns;
+	int error;
+	u32 total_us;
+	u32 phase_us[SUSPEND_PHASE_COUNT];
+	unsigned int calls;
+	struct suspend_profile_call slowest[SUSPEND_PROFILE_SLOWEST];
+};
+
+static const char * const kind_names[] = {
+	[SUSPEND_PROFILE_SUSPEND]	= "suspend",
+	[SUSPEND_PROFILE_EARLY_SUSPEND]	= "early_suspend",
+	[SUSPEND_PROFILE_LATE_RESUME]	= "late_resume",
+};
+
+static const char * const phase_names[] = {
+	[SUSPEND_PHASE_SYNC]		= "sync",
+	[SUSPEND_PHASE_FREEZE]		= "freeze",
+	[SUSPEND_PHASE_SUSPEND_DEVICES]	= "suspend_devices",
+	[SUSPEND_PHASE_SUSPEND_NOIRQ]	= "suspend_noirq",
+	[SUSPEND_PHASE_RESUME_NOIRQ]	= "resume_noirq",
+	[SUSPEND_PHASE_RESUME_DEVICES]	= "resume_devices",
+	[SUSPEND_PHASE_THAW]		= "thaw",
+	[SUSPEND_PHASE_HANDLERS]	= "handlers",
+};
+
+static DEFINE_SPINLOCK(profile_lock);
+static struct suspend_profile_record history[SUSPEND_PROFILE_HISTORY];
+static unsigned int next_seq;
+
+/* Open record and the phase being timed; protected by profile_lock */
+static struct suspend_profile_record *cur;
+static int cur_depth;
+static int cur_phase = -1;
+static unsigned int cur_outer_phases;	/* phases timed at depth 1 */
+static ktime_t cur_start;
+
+static u32 elapsed_us(ktime_t start)
+{
+	s64 us = ktime_to_us(ktime_sub(ktime_get(), start));
+
+	return clamp_t(s64, us, 0, UINT_MAX);
+}
+
+bool suspend_profile_active(void)
+{
+	return cur != NULL;
+}
+
+/*
+ * Open a record.  Nested calls, such as enter_state() under the
+ * wakelock suspend work, extend the outer record.
+ */
+void suspend_profile_begin(enum suspend_profile_kind kind)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&profile_lock, flags);
+	if (!cur_depth++) {
+		cur = &history[next_seq % SUSPEND_PROFILE_HISTORY];
+		memset(cur, 0, sizeof(*cur));
+		cur->seq = next_seq++;
+		cur->kind = kind;
+		cur_start = ktime_get();
+		cur->start_ns = ktime_to_ns(cur_start);
+		cur_phase = -1;
+		cur_outer_phases = 0;
+	}
+	spin_unlock_irqrestore(&profile_lock, flags);
+}
+
+void suspend_profile_end(int error)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&profile_lock, flags);
+	if (cur_depth && !--cur_depth) {
+		cur->error = error;
+		cur->total_us = elapsed_us(cur_start);
+		cur = NULL;
+	}
+	spin_unlock_irqrestore(&profile_lock, flags);
+}
+
+ktime_t suspend_profile_phase_start(enum suspend_profile_phase phase)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&profile_lock, flags);
+	cur_phase = phase;
+	spin_unlock_irqrestore(&profile_lock, flags);
+	return ktime_get();
+}
+
+/*
+ * A nested record repeats phases its caller has already timed: the
+ * wakelock suspend work syncs and then enter_state() syncs again.  Only
+ * the outermost level counts those, so the record is not inflated.
+ */
+void suspend_profile_phase_end(enum suspend_profile_phase phase,
+			       ktime_t start)
+{
+	unsigned long flags;
+	u32 usecs = elapsed_us(start);
+
+	trace_suspend_profile_phase(phase_names[phase], usecs);
+
+	spin_lock_irqsave(&profile_lock, flags);
+	if (cur_depth == 1)
+		cur_outer_phases |= 1U << phase;
+	if (cur && (cur_depth == 1 || !(cur_outer_phases & (1U << phase))))
+		cur->phase_us[phase] += usecs;
+	cur_phase = -1;
+	spin_unlock_irqrestore(&profile_lock, flags);
+}
+
+static void record_call(const char *name, void *func, u32 usecs)
+{
+	struct suspend_profile_call *c, *min = NULL;
+	int i;
+
+	cur->calls++;
+
+	/* Several callbacks of one device in one phase add up */
+	for (i = 0; i < SUSPEND_PROFILE_SLOWEST; i++) {
+		c = &cur->slowest[i];
+		if (c->usecs && c->phase == cur_phase && c->func == func &&
+		    (!name || !strncmp(c->name, name, sizeof(c->name) - 1))) {
+			c->usecs += usecs;
+			return;
+		}
+		if (!min || c->usecs < min->usecs)
+			min = c;
+	}
+
+	if (usecs <= min->usecs)
+		return;
+
+	min->func = func;
+	min->phase = cur_phase < 0 ? SUSPEND_PHASE_COUNT : cur_phase;
+	min->usecs = usecs;
+	strlcpy(min->name, name ? name : "", sizeof(min->name));
+}
+
+/*
+ * Account one device callback (@name) or early suspend handler (@func)
+ * started at @start to the phase being timed.
+ */
+void suspend_profile_call(const char *name, void *func, ktime_t start)
+{
+	unsigned long flags;
+	u32 usecs = elapsed_us(start);
+
+	trace_suspend_profile_call(name, func, usecs);
+
+	spin_lock_irqsave(&profile_lock, flags);
+	if (cur)
+		record_call(name, func, usecs);
+	spin_unlock_irqrestore(&profile_lock, flags);
+}
+
+static void suspend_profile_show_record(struct seq_file *m,
+					struct suspend_profile_record *r)
+{
+	struct suspend_profile_call *c;
+	unsigned long rem_ns;
+	u64 ts;
+	int i;
+
+	ts = r->start_ns;
+	rem_ns = do_div(ts, NSEC_PER_SEC);
+	seq_printf(m, "#%u %s at %llu.%06lu: %u us, error %d, %u calls\n",
+		   r->seq, kind_names[r->kind], ts, rem_ns / NSEC_PER_USEC,
+		   r->total_us, r->error, r->calls);
+
+	for (i = 0; i < SUSPEND_PHASE_COUNT; i++)
+		if (r->phase_us[i])
+			seq_printf(m, "  %-16s %10u us\n", phase_names[i],
+				   r->phase_us[i]);
+
+	for (i = 0; i < SUSPEND_PROFILE_SLOWEST; i++) {
+		c = &r->slowest[i];
+		if (!c->usecs)
+			continue;
+		seq_printf(m, "    %-16s %10u us  ",
+			   c->phase < SUSPEND_PHASE_COUNT ?
+			   phase_names[c->phase] : "-", c->usecs);
+		if (c->name[0])
+			seq_printf(m, "%s\n", c->name);
+		else
+			seq_printf(m, "%pf\n", c->func);
+	}
+}
+
+static int suspend_profile_show(struct seq_file *m, void *unused)
+{
+	struct suspend_profile_record r;
+	unsigned long flags;
+	unsigned int seq, end;
+
+	spin_lock_irqsave(&profile_lock, flags);
+	end = next_seq;
+	spin_unlock_irqrestore(&profile_lock, flags);
+
+	seq = end > SUSPEND_PROFILE_HISTORY ? end - SUSPEND_PROFILE_HISTORY : 0;
+	for (; seq != end; seq++) {
+		spin_lock_irqsave(&profile_lock, flags);
+		r = history[seq % SUSPEND_PROFILE_HISTORY];
+		spin_unlock_irqrestore(&profile_lock, flags);
+
+		/* Overwritten while we were printing older records */
+		if (r.seq != seq)
+			continue;
+
+		suspend_profile_show_record(m, &r);
+	}
+
+	return 0;
+}
+
+static int suspend_profile_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, suspend_profile_show, NULL);
+}
+
+static const struct file_operations suspend_profile_fops = {
+	.open		= suspend_profile_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init suspend_profile_init(void)
+{
+	debugfs_create_file("suspend_profile", S_IRUGO, NULL, NULL,
+			    &suspend_profile_fops);
+	return 0;
+}
+late_initcall(suspend_profile_init);
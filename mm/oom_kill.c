@@ -568,6 +568,32 @@ int unregister_oom_notifier(struct notifier_block *nb)
 }
 EXPORT_SYMBOL_GPL(unregister_oom_notifier);
 
+static ATOMIC_NOTIFIER_HEAD(oom_adj_notify_list);
+
+int register_oom_adj_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_register(&oom_adj_notify_list, nb);
+}
+EXPORT_SYMBOL_GPL(register_oom_adj_notifier);
+
+int unregister_oom_adj_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_unregister(&oom_adj_notify_list, nb);
+}
+EXPORT_SYMBOL_GPL(unregister_oom_adj_notifier);
+
+/*
+ * Called for every new process, whenever the oom_adj of a process may
+ * have changed, when exec makes a thread the group leader, and from
+ * release_task() once the task is unhashed (pid_alive() is false then).
+ * Listeners read the current state themselves, so calls racing with each
+ * other need no ordering.
+ */
+void oom_adj_notify(struct task_struct *p)
+{
+	atomic_notifier_call_chain(&oom_adj_notify_list, 0, p);
+}
+
 /*
  * Try to acquire the OOM killer lock for the zones in zonelist.  Returns zero
  * if a parallel OOM killing is already taking place that includes a zone in
@@ -0,0 +1,217 @@
+/*
+ * fsbench: read or write files with several threads at once
+ *
+ * Used by squashfs-read.sh to compare decompressor settings: each thread
+ * takes the next file not yet read and reads it to the end, so independent
+ * files are read in parallel.  Used by yaffs2-nandsim.sh to measure write
+ * throughput: each thread writes and syncs a file of its own.
+ *
+ * Compile by:
+ *
+ * gcc -O2 -Wall -o fsbench fsbench.c -lpthread -lrt
+ *
+ * This file is released under the GPLv2.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+static char **files;
+static unsigned long nr_files, max_files;
+static unsigned long next_file;
+static size_t bufsize = 128 * 1024;
+static unsigned long long file_size = 8 * 1024 * 1024;
+static const char *dir;
+static unsigned long long total_bytes;
+static int errors;
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: fsbench [-t threads] [-b bufsize] [-s size] read|write DIR\n"
+		"\n"
+		"  read   read every regular file under DIR once\n"
+		"  write  each thread writes DIR/fsbench.N and fsyncs it\n"
+		"\n"
+		"  -t     number of threads (default: online cpus)\n"
+		"  -b     read or write size in bytes (default: 131072)\n"
+		"  -s     bytes written per thread (default: 8388608)\n");
+	exit(1);
+}
+
+static int add_file(const char *path, const struct stat *st, int type,
+		    struct FTW *ftw)
+{
+	if (type != FTW_F || !S_ISREG(st->st_mode))
+		return 0;
+
+	if (nr_files == max_files) {
+		max_files = max_files ? 2 * max_files : 1024;
+		files = realloc(files, max_files * sizeof(*files));
+		if (!files) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	files[nr_files] = strdup(path);
+	if (!files[nr_files]) {
+		perror("strdup");
+		exit(1);
+	}
+	nr_files++;
+	return 0;
+}
+
+static void *reader(void *arg)
+{
+	unsigned long long bytes = 0;
+	unsigned long i;
+	char *buf;
+	ssize_t n;
+	int fd;
+
+	buf = malloc(bufsize);
+	if (!buf) {
+		perror("malloc");
+		exit(1);
+	}
+
+	while ((i = __sync_fetch_and_add(&next_file, 1)) < nr_files) {
+		fd = open(files[i], O_RDONLY);
+		if (fd < 0) {
+			fprintf(stderr, "%s: %s\n", files[i], strerror(errno));
+			__sync_fetch_and_add(&errors, 1);
+			continue;
+		}
+		while ((n = read(fd, buf, bufsize)) > 0)
+			bytes += n;
+		if (n < 0) {
+			fprintf(stderr, "%s: %s\n", files[i], strerror(errno));
+			__sync_fetch_and_add(&errors, 1);
+		}
+		close(fd);
+	}
+
+	__sync_fetch_and_add(&total_bytes, bytes);
+	free(buf);
+	return NULL;
+}
+
+static void *writer(void *arg)
+{
+	unsigned long long bytes = 0;
+	char path[4096];
+	char *buf;
+	ssize_t n;
+	int fd;
+
+	buf = malloc(bufsize);
+	if (!buf) {
+		perror("malloc");
+		exit(1);
+	}
+	memset(buf, (long)arg, bufsize);
+
+	snprintf(path, sizeof(path), "%s/fsbench.%ld", dir, (long)arg);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		goto err;
+	while (bytes < file_size) {
+		n = write(fd, buf, file_size - bytes < bufsize ?
+				   file_size - bytes : bufsize);
+		if (n < 0)
+			goto err;
+		bytes += n;
+	}
+	if (fsync(fd) || close(fd))
+		goto err;
+
+	__sync_fetch_and_add(&total_bytes, bytes);
+	free(buf);
+	return NULL;
+
+err:
+	fprintf(stderr, "%s: %s\n", path, strerror(errno));
+	__sync_fetch_and_add(&errors, 1);
+	__sync_fetch_and_add(&total_bytes, bytes);
+	free(buf);
+	return NULL;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	long nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	void *(*fn)(void *) = reader;
+	pthread_t *threads;
+	double start, secs;
+	long i;
+	int c;
+
+	while ((c = getopt(argc, argv, "t:b:s:")) != -1) {
+		switch (c) {
+		case 't':
+			nr_threads = atol(optarg);
+			break;
+		case 'b':
+			bufsize = atol(optarg);
+			break;
+		case 's':
+			file_size = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc - optind != 2 || nr_threads < 1 || !bufsize)
+		usage();
+	dir = argv[optind + 1];
+	if (!strcmp(argv[optind], "write"))
+		fn = writer;
+	else if (strcmp(argv[optind], "read"))
+		usage();
+
+	if (fn == reader && nftw(dir, add_file, 64, FTW_PHYS)) {
+		perror(dir);
+		return 1;
+	}
+
+	threads = calloc(nr_threads, sizeof(*threads));
+	if (!threads) {
+		perror("calloc");
+		return 1;
+	}
+
+	start = now();
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_create(&threads[i], NULL, fn, (void *)i)) {
+			perror("pthread_create");
+			return 1;
+		}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	secs = now() - start;
+
+	printf("%ld threads: %lu files, %llu bytes in %.3f s, %.1f MB/s\n",
+	       nr_threads, fn == reader ? nr_files : nr_threads,
+	       total_bytes, secs,
+	       secs > 0 ? total_bytes / secs / (1024 * 1024) : 0.0);
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,44 @@
+#!/bin/sh
+#
+# Parallel read throughput of a loop-mounted squashfs image, once per
+# decompressor setting (mount option threads=).
+#
+# usage: squashfs-read.sh SRC_DIR [COMP]
+#
+# Builds an image of SRC_DIR with mksquashfs (COMP defaults to gzip), then
+# for threads=single, multi and percpu mounts it, drops the caches and
+# reads every file with fsbench, NTHREADS readers at once (default: one
+# per online cpu).  Needs root, mksquashfs and fsbench built next to this
+# script.
+#
+# This file is released under the GPLv2.
+
+set -e
+
+if [ $# -lt 1 ]; then
+	echo "usage: $0 SRC_DIR [COMP]" >&2
+	exit 1
+fi
+
+src=$1
+comp=${2:-gzip}
+bench=$(dirname "$0")/fsbench
+tmp=${TMPDIR:-/tmp}
+img=$tmp/fsbench.sqsh
+mnt=$tmp/fsbench.mnt
+nthreads=${NTHREADS:-$(getconf _NPROCESSORS_ONLN)}
+
+mksquashfs "$src" "$img" -noappend -comp "$comp" > /dev/null
+mkdir -p "$mnt"
+
+for opt in single multi percpu; do
+	mount -t squashfs -o loop,ro,threads=$opt "$img" "$mnt"
+	sync
+	echo 3 > /proc/sys/vm/drop_caches
+	printf "threads=%-6s " $opt
+	"$bench" -t "$nthreads" read "$mnt" || true
+	umount "$mnt"
+done
+
+rmdir "$mnt"
+rm -f "$img"
@@ -0,0 +1,57 @@
+#!/bin/sh
+#
+# Multi-threaded yaffs2 throughput on a simulated NAND device.
+#
+# usage: yaffs2-nandsim.sh [THREADS...]
+#
+# For each thread count (default: 1 2 4 8), loads nandsim as a fresh
+# 128MiB, 2KiB page device, mounts it as yaffs2, writes SIZE bytes
+# (default 8MiB) per thread with fsbench, then drops the caches and
+# reads the files back with the same number of threads.  The yaffs
+# lock_contended and bg_gc_yields counters from /proc/yaffs are shown
+# after each run.  Needs root, nandsim, mtdblock and fsbench built next
+# to this script.
+#
+# This file is released under the GPLv2.
+
+set -e
+
+bench=$(dirname "$0")/fsbench
+mnt=${TMPDIR:-/tmp}/fsbench.yaffs2
+size=${SIZE:-8388608}
+
+nand_load()
+{
+	modprobe nandsim first_id_byte=0x20 second_id_byte=0xaa \
+		third_id_byte=0x00 fourth_id_byte=0x15
+	modprobe mtdblock
+	mtd=$(grep -m1 '"NAND simulator' /proc/mtd | cut -d: -f1)
+	if [ -z "$mtd" ]; then
+		echo "no nandsim mtd device" >&2
+		exit 1
+	fi
+	mount -t yaffs2 /dev/mtdblock${mtd#mtd} "$mnt"
+}
+
+nand_unload()
+{
+	umount "$mnt"
+	rmmod mtdblock
+	rmmod nandsim
+}
+
+mkdir -p "$mnt"
+
+for threads in ${*:-1 2 4 8}; do
+	nand_load
+	printf "write %-2s " $threads
+	"$bench" -t $threads -s $size write "$mnt" || true
+	sync
+	echo 3 > /proc/sys/vm/drop_caches
+	printf "read  %-2s " $threads
+	"$bench" -t $threads read "$mnt" || true
+	grep -E 'lock_contended|bg_gc_yields' /proc/yaffs || true
+	nand_unload
+done
+
+rmdir "$mnt"
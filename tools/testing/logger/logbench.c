@@ -0,0 +1,144 @@
+/*
+ * logbench: Android logger write throughput with several writer threads
+ *
+ * Each thread writes COUNT entries to a log device the way liblog does,
+ * with one writev() of priority, tag and message per entry.  Run it with
+ * 1, 2, 4, ... threads to see how the write path scales.
+ *
+ * Compile by:
+ *
+ * gcc -O2 -Wall -o logbench logbench.c -lpthread -lrt
+ *
+ * This file is released under the GPLv2.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+static const char *device = "/dev/log/main";
+static unsigned long count = 100000;
+static size_t msg_len = 64;
+static int errors;
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: logbench [-t threads] [-n entries] [-s msglen] [DEVICE]\n"
+		"\n"
+		"  -t     number of writer threads (default: online cpus)\n"
+		"  -n     entries written per thread (default: 100000)\n"
+		"  -s     message length in bytes (default: 64)\n"
+		"  DEVICE log device (default: /dev/log/main)\n");
+	exit(1);
+}
+
+static void *writer(void *arg)
+{
+	unsigned char prio = 4;	/* ANDROID_LOG_INFO */
+	const char *tag = "logbench";
+	struct iovec vec[3];
+	unsigned long i;
+	char *msg;
+	int fd;
+
+	msg = malloc(msg_len + 1);
+	if (!msg) {
+		perror("malloc");
+		exit(1);
+	}
+	memset(msg, 'a' + (long)arg % 26, msg_len);
+	msg[msg_len] = '\0';
+
+	fd = open(device, O_WRONLY);
+	if (fd < 0) {
+		fprintf(stderr, "%s: %s\n", device, strerror(errno));
+		__sync_fetch_and_add(&errors, 1);
+		free(msg);
+		return NULL;
+	}
+
+	vec[0].iov_base = &prio;
+	vec[0].iov_len = 1;
+	vec[1].iov_base = (void *)tag;
+	vec[1].iov_len = strlen(tag) + 1;
+	vec[2].iov_base = msg;
+	vec[2].iov_len = msg_len + 1;
+
+	for (i = 0; i < count; i++)
+		if (writev(fd, vec, 3) < 0) {
+			fprintf(stderr, "%s: %s\n", device, strerror(errno));
+			__sync_fetch_and_add(&errors, 1);
+			break;
+		}
+
+	close(fd);
+	free(msg);
+	return NULL;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	long nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	pthread_t *threads;
+	double start, secs;
+	long i;
+	int c;
+
+	while ((c = getopt(argc, argv, "t:n:s:")) != -1) {
+		switch (c) {
+		case 't':
+			nr_threads = atol(optarg);
+			break;
+		case 'n':
+			count = atol(optarg);
+			break;
+		case 's':
+			msg_len = atol(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc - optind > 1 || nr_threads < 1)
+		usage();
+	if (optind < argc)
+		device = argv[optind];
+
+	threads = calloc(nr_threads, sizeof(*threads));
+	if (!threads) {
+		perror("calloc");
+		return 1;
+	}
+
+	start = now();
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_create(&threads[i], NULL, writer, (void *)i)) {
+			perror("pthread_create");
+			return 1;
+		}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	secs = now() - start;
+
+	printf("%ld threads: %lu entries in %.3f s, %.0f entries/s, "
+	       "%.2f us per entry per thread\n",
+	       nr_threads, nr_threads * count, secs,
+	       secs > 0 ? nr_threads * count / secs : 0.0,
+	       count ? secs * 1e6 / count : 0.0);
+
+	return errors ? 1 : 0;
+}